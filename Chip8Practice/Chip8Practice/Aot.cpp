@@ -0,0 +1,42 @@
+/*
+Chip-8 Emulator -- ahead-of-time translator
+Writes the C++ translation of a ROM (see Recompiler.h) without SDL, so it builds wherever the
+core does. Without a ROM it translates AOT_TEST_ROM, which the CMake build does to check
+AotHarness against the interpreter.
+*/
+
+#include <iostream>
+#include <fstream>
+#include "Chip8.h"
+#include "Recompiler.h"
+
+int main(int argc, char* argv[]) {
+	if (argc != 2 && argc != 3) {
+		std::cerr << "Usage: " << argv[0] << " <Output.cpp> [ROM]\n";
+		return -1;
+	}
+	const char* outputFilename = argv[1];
+	const char* romFilename = argc == 3 ? argv[2] : nullptr;
+
+	Chip8* chip8 = new Chip8(1);
+	if (romFilename == nullptr) {
+		loadROMData(*chip8, AOT_TEST_ROM, sizeof(AOT_TEST_ROM));
+	}
+	else if (tryLoadROM(romFilename, *chip8) < 0) {
+		delete chip8;
+		return -1;
+	}
+
+	Recompiler recompiler(*chip8);
+	std::ofstream out(outputFilename);
+	recompiler.Emit(out, romFilename != nullptr ? romFilename : "AOT_TEST_ROM");
+	if (!out) {
+		std::cerr << "Failed to write " << outputFilename << std::endl;
+		delete chip8;
+		return -1;
+	}
+	std::cout << "Translated " << recompiler.BlockCount() << " basic blocks to " << outputFilename << std::endl;
+
+	delete chip8;
+	return 0;
+}
@@ -0,0 +1,74 @@
+/*
+Chip-8 Emulator -- AOT harness
+Runs a ROM on the interpreter and on its ahead-of-time translation (chip8_aot) side by side and checks that
+they produce the same framebuffer (and machine state) after every chunk of cycles.
+Without a ROM it runs AOT_TEST_ROM, which rewrites translated code from untranslated code.
+The CMake target aot_harness is that build; for another ROM, build it with its translation:
+	chip8_aot rom_aot.cpp game.ch8
+	g++ -std=c++17 -O3 AotHarness.cpp Chip8.cpp rom_aot.cpp -o aot-harness
+	./aot-harness game.ch8 10000000
+*/
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include "Chip8.h"
+#include "Recompiler.h"
+
+void Chip8AotRun(Chip8& c, uint64_t cycles); // Defined by the generated translation unit
+
+int main(int argc, char* argv[]) {
+	if (argc > 3) {
+		std::cerr << "Usage: " << argv[0] << " [ROM [Cycles]]\n";
+		return -1;
+	}
+	uint64_t cycles = argc > 2 ? std::stoull(argv[2]) : 10000000;
+
+	Chip8* interpreted = new Chip8(1);
+	Chip8* compiled = new Chip8(1);
+	for (Chip8* chip8 : { interpreted, compiled }) {
+		if (argc > 1) loadROM(argv[1], *chip8);
+		else loadROMData(*chip8, AOT_TEST_ROM, sizeof(AOT_TEST_ROM));
+	}
+
+	// Lockstep in chunks, comparing the framebuffer and the rest of the machine after each one
+	const uint64_t chunk = 1000;
+	uint64_t done = 0;
+	double interpretedSeconds = 0;
+	double compiledSeconds = 0;
+	while (done < cycles) {
+		uint64_t step = std::min(chunk, cycles - done);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		interpreted->Run(step);
+		auto middle = std::chrono::high_resolution_clock::now();
+		Chip8AotRun(*compiled, step);
+		auto end = std::chrono::high_resolution_clock::now();
+		interpreted->TickTimers(); // A chunk per frame
+		compiled->TickTimers();
+		interpretedSeconds += std::chrono::duration<double>(middle - start).count();
+		compiledSeconds += std::chrono::duration<double>(end - middle).count();
+		done += step;
+
+		bool sameScreen = std::equal(std::begin(interpreted->screen), std::end(interpreted->screen), std::begin(compiled->screen));
+		bool sameState = sameScreen
+			&& std::equal(std::begin(interpreted->registers), std::end(interpreted->registers), std::begin(compiled->registers))
+			&& std::equal(std::begin(interpreted->memory), std::end(interpreted->memory), std::begin(compiled->memory))
+			&& std::equal(std::begin(interpreted->stack), std::end(interpreted->stack), std::begin(compiled->stack))
+			&& interpreted->index == compiled->index && interpreted->pc == compiled->pc && interpreted->sp == compiled->sp
+			&& interpreted->delay_timer == compiled->delay_timer && interpreted->sound_timer == compiled->sound_timer;
+		if (!sameState) {
+			std::cerr << (sameScreen ? "Machine state" : "Framebuffer") << " differs after " << done << " cycles (pc "
+				<< std::hex << compiled->pc << ", interpreter at " << interpreted->pc << std::dec << ")" << std::endl;
+			return -1;
+		}
+	}
+
+	std::cout << "Identical framebuffer and state over " << done << " cycles" << std::endl;
+	std::cout << "Interpreter: " << done / interpretedSeconds / 1e6 << " M instructions/s, AOT: "
+		<< done / compiledSeconds / 1e6 << " M instructions/s" << std::endl;
+
+	delete interpreted;
+	delete compiled;
+	return 0;
+}
@@ -0,0 +1,241 @@
+/*
+Chip-8 Emulator -- batch runner
+Runs every job of a manifest on its own Chip8 instance across all cores (WorkStealingPool.h),
+a slice of frames at a time, and writes one result line per job in manifest order. --trace
+writes a timeline of the slices each worker ran (Trace.h).
+
+Manifest, one job per line, '#' starts a comment:
+	<ROM> <frames> [<input script> | -] [seed]
+Output, tab separated, with a header line:
+	job status frames cycles skipped_frames screen_hash state_hash wall_us
+status is ok, blocked (left waiting on Fx0A with no input to come) or error.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include "Chip8.h"
+#include "HeadlessRun.h"
+#include "WorkStealingPool.h"
+#include "Trace.h"
+
+namespace {
+
+struct Job {
+	std::string rom;
+	uint64_t frames{};
+	std::string input;			// Empty for no input
+	uint64_t seed{ 1 };
+
+	const std::vector<uint8_t>* romData{};
+	const std::vector<InputEvent>* events{};
+
+	// Run state, the instance only exists between the first and the last slice
+	std::unique_ptr<Chip8> chip8;
+	uint64_t frame{};
+	size_t nextEvent{};
+	RunResult result;
+	double seconds{};
+	bool failed{};
+	uint64_t screenHash{};
+	uint64_t stateHash{};
+};
+
+void printUsage(const char* program) {
+	std::cerr << "Usage: " << program << " <Manifest> <Output> [--threads <n>] [--slice-frames <n>] [--ipf <n>]"
+		<< " [--backend table|switch|threaded|predecoded|blocks|jit] [--trace <json>]\n";
+}
+
+bool parseManifest(const char* filename, std::vector<Job>& jobs) {
+	std::ifstream in(filename);
+	if (!in) {
+		std::cerr << "Cannot open manifest " << filename << std::endl;
+		return false;
+	}
+
+	std::string line;
+	for (unsigned int lineNumber = 1; std::getline(in, line); lineNumber++) {
+		line = line.substr(0, line.find('#'));
+		std::istringstream fields(line);
+		Job job;
+		std::string frames, input, seed;
+		if (!(fields >> job.rom)) continue;
+		try {
+			fields >> frames >> input >> seed;
+			job.frames = std::stoull(frames);
+			if (input != "-") job.input = input;
+			if (!seed.empty()) job.seed = std::stoull(seed);
+		}
+		catch (const std::exception&) {
+			std::cerr << filename << ", line " << lineNumber << ": expected <ROM> <frames> [<input script> | -] [seed]" << std::endl;
+			return false;
+		}
+		jobs.push_back(std::move(job));
+	}
+	return true;
+}
+
+// Reads every ROM and input script once, the jobs share them read-only
+bool loadShared(std::vector<Job>& jobs, std::map<std::string, std::vector<uint8_t>>& roms,
+	std::map<std::string, std::vector<InputEvent>>& scripts) {
+	static const std::vector<InputEvent> noEvents;
+	for (Job& job : jobs) {
+		auto rom = roms.find(job.rom);
+		if (rom == roms.end()) {
+			std::ifstream in(job.rom, std::ios::binary);
+			if (!in) {
+				std::cerr << "Cannot open ROM " << job.rom << std::endl;
+				return false;
+			}
+			rom = roms.emplace(job.rom, std::vector<uint8_t>(std::istreambuf_iterator<char>(in), {})).first;
+		}
+		job.romData = &rom->second;
+
+		if (job.input.empty()) {
+			job.events = &noEvents;
+			continue;
+		}
+		auto script = scripts.find(job.input);
+		if (script == scripts.end()) {
+			std::vector<InputEvent> events;
+			std::string error;
+			if (!loadInputScript(job.input.c_str(), events, error)) {
+				std::cerr << "Bad input script " << job.input << ": " << error << std::endl;
+				return false;
+			}
+			script = scripts.emplace(job.input, std::move(events)).first;
+		}
+		job.events = &script->second;
+	}
+	return true;
+}
+
+// One time slice of a job, returns whether it is finished
+bool runSlice(Job& job, const RunLimits& slice, Backend backend) {
+	TraceScope scope("Slice");
+	auto start = std::chrono::steady_clock::now();
+
+	if (!job.chip8) {
+		job.chip8 = std::make_unique<Chip8>(job.seed);
+		job.chip8->backend = backend;
+		if (!loadROMData(*job.chip8, job.romData->data(), job.romData->size())) {
+			job.failed = true;
+			job.chip8.reset();
+			return true;
+		}
+	}
+
+	RunLimits limits = slice;
+	limits.frames = std::min(slice.frames, job.frames - job.frame);
+	RunResult result = limits.frames > 0 ? runScripted(*job.chip8, *job.events, limits, job.frame, job.nextEvent) : RunResult{};
+	job.result.frames += result.frames;
+	job.result.cycles += result.cycles;
+	job.result.skippedFrames += result.skippedFrames;
+	job.result.blockedOnInput = result.blockedOnInput;
+
+	bool finished = job.frame >= job.frames;
+	if (finished) {
+		job.screenHash = hashScreen(*job.chip8);
+		job.stateHash = hashState(*job.chip8);
+		job.chip8.reset(); // Only running jobs hold an instance
+	}
+	job.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return finished;
+}
+
+bool writeResults(const char* filename, const std::vector<Job>& jobs) {
+	std::ofstream out(filename);
+	out << "job\tstatus\tframes\tcycles\tskipped_frames\tscreen_hash\tstate_hash\twall_us\n";
+	for (size_t i = 0; i < jobs.size(); i++) {
+		const Job& job = jobs[i];
+		const char* status = job.failed ? "error" : job.result.blockedOnInput ? "blocked" : "ok";
+		out << i << "\t" << status << "\t" << job.result.frames << "\t" << job.result.cycles << "\t" << job.result.skippedFrames
+			<< "\t" << std::hex << std::setfill('0') << std::setw(16) << job.screenHash << "\t" << std::setw(16) << job.stateHash
+			<< std::dec << "\t" << (uint64_t)(job.seconds * 1e6) << "\n";
+	}
+	return (bool)out;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+	std::vector<const char*> args;
+	unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+	RunLimits slice;
+	slice.frames = 600; // 10 s of emulated time per slice
+	Backend backend = Backend::Predecoded;
+	const char* traceFilename = nullptr;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--threads" && i + 1 < argc) {
+			threads = std::max(1, std::stoi(argv[++i]));
+		}
+		else if (arg == "--slice-frames" && i + 1 < argc) {
+			slice.frames = std::max(1ull, std::stoull(argv[++i]));
+		}
+		else if (arg == "--ipf" && i + 1 < argc) {
+			slice.instructionsPerFrame = std::max(1, std::stoi(argv[++i]));
+		}
+		else if (arg == "--backend" && i + 1 < argc) {
+			if (!parseBackend(argv[++i], backend)) {
+				std::cerr << "Unknown backend: " << argv[i] << std::endl;
+				return -1;
+			}
+		}
+		else if (arg == "--trace" && i + 1 < argc) {
+			traceFilename = argv[++i];
+		}
+		else {
+			args.push_back(argv[i]);
+		}
+	}
+	if (args.size() != 2) {
+		printUsage(argv[0]);
+		return -1;
+	}
+
+	std::vector<Job> jobs;
+	std::map<std::string, std::vector<uint8_t>> roms;
+	std::map<std::string, std::vector<InputEvent>> scripts;
+	if (!parseManifest(args[0], jobs) || !loadShared(jobs, roms, scripts)) return -1;
+
+	WorkStealingPool pool(threads);
+	if (traceFilename != nullptr) Trace::Start(); // One track per worker, a slice per event
+	auto start = std::chrono::steady_clock::now();
+	pool.Run(jobs.size(), [&jobs, &slice, backend](size_t task, size_t worker) {
+		if (Trace::Enabled()) Trace::NameThread("worker " + std::to_string(worker));
+		return runSlice(jobs[task], slice, backend);
+	});
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (traceFilename != nullptr) {
+		Trace::Stop();
+		std::ofstream trace(traceFilename);
+		if (!Trace::WriteJson(trace)) {
+			std::cerr << "Failed to write " << traceFilename << std::endl;
+			return -1;
+		}
+	}
+
+	if (!writeResults(args[1], jobs)) {
+		std::cerr << "Failed to write " << args[1] << std::endl;
+		return -1;
+	}
+
+	uint64_t cycles = 0;
+	size_t failed = 0;
+	for (const Job& job : jobs) {
+		cycles += job.result.cycles;
+		failed += job.failed;
+	}
+	std::cout << jobs.size() << " jobs (" << failed << " failed) on " << pool.ThreadCount() << " threads in " << seconds << " s, "
+		<< cycles / seconds / 1e6 << " M instructions/s" << std::endl;
+	return failed == 0 ? 0 : -1;
+}
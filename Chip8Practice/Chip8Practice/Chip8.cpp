@@ -0,0 +1,320 @@
+/*
+Chip-8 Emulator -- CPU core, out-of-line parts
+ROM loading, the binary save-state format and the helpers every frontend shares (state
+hashing, opcode profiles, backend names).
+*/
+
+#include "Chip8.h"
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+long tryLoadROM(const char* filename, Chip8& chip8) {
+	FILE* file = nullptr;
+#if defined(_MSC_VER)
+	if (fopen_s(&file, filename, "rb") != 0) file = nullptr; // fopen is deprecated under /sdl
+#else
+	file = std::fopen(filename, "rb");
+#endif
+
+	// Failed to open ROM
+	if (file == nullptr) {
+		std::cerr << "Failed to open ROM file: " << filename << std::endl;
+		return -1;
+	}
+	// ROM size too big
+	std::fseek(file, 0, SEEK_END);
+	long fileSize = std::ftell(file);
+	std::fseek(file, 0, SEEK_SET);
+	if (fileSize < 0 || (unsigned long)fileSize > sizeof(chip8.memory) - START_ADDRESS) {
+		std::cerr << "Size of ROM file is too big: " << filename << std::endl;
+		std::fclose(file);
+		return -1;
+	}
+
+	// Read the ROM content into memory starting at address 0x200
+	size_t read = std::fread(&chip8.memory[START_ADDRESS], 1, (size_t)fileSize, file);
+	std::fclose(file);
+	chip8.InvalidateCode(START_ADDRESS, sizeof(chip8.memory) - START_ADDRESS);
+	return (long)read;
+}
+
+bool loadROMData(Chip8& chip8, const uint8_t* data, size_t size) {
+	if (size > sizeof(chip8.memory) - START_ADDRESS) return false;
+	std::copy(data, data + size, &chip8.memory[START_ADDRESS]);
+	chip8.InvalidateCode(START_ADDRESS, sizeof(chip8.memory) - START_ADDRESS);
+	return true;
+}
+
+void loadROM(const char* filename, Chip8& chip8) {
+	long fileSize = tryLoadROM(filename, chip8);
+	if (fileSize < 0) {
+		std::exit(-1);
+	}
+	std::cout << "File size: " << fileSize << std::endl;
+}
+
+namespace {
+
+struct Fnv1a {
+	uint64_t hash = 14695981039346656037ULL;
+
+	void Mix(const void* data, size_t size) {
+		const uint8_t* bytes = (const uint8_t*)data;
+		for (size_t i = 0; i < size; i++) {
+			hash = (hash ^ bytes[i]) * 1099511628211ULL;
+		}
+	}
+};
+
+} // namespace
+
+uint64_t hashState(const Chip8& chip8) {
+	Fnv1a fnv;
+	fnv.Mix(chip8.registers, sizeof(chip8.registers));
+	fnv.Mix(chip8.memory, sizeof(chip8.memory));
+	fnv.Mix(&chip8.index, sizeof(chip8.index));
+	fnv.Mix(&chip8.pc, sizeof(chip8.pc));
+	fnv.Mix(chip8.stack, sizeof(chip8.stack));
+	fnv.Mix(&chip8.sp, sizeof(chip8.sp));
+	fnv.Mix(&chip8.delay_timer, sizeof(chip8.delay_timer));
+	fnv.Mix(&chip8.sound_timer, sizeof(chip8.sound_timer));
+	fnv.Mix(&chip8.waitingForKey, sizeof(chip8.waitingForKey));
+	fnv.Mix(chip8.screen, sizeof(chip8.screen));
+	return fnv.hash;
+}
+
+uint64_t hashScreen(const Chip8& chip8) {
+	Fnv1a fnv;
+	fnv.Mix(chip8.screen, sizeof(chip8.screen));
+	return fnv.hash;
+}
+
+uint64_t hashProgram(const Chip8& chip8) {
+	Fnv1a fnv;
+	fnv.Mix(&chip8.memory[START_ADDRESS], sizeof(chip8.memory) - START_ADDRESS);
+	return fnv.hash;
+}
+
+bool sameState(const Chip8& a, const Chip8& b) {
+	return std::equal(std::begin(a.registers), std::end(a.registers), std::begin(b.registers))
+		&& std::equal(std::begin(a.memory), std::end(a.memory), std::begin(b.memory))
+		&& a.index == b.index && a.pc == b.pc
+		&& std::equal(std::begin(a.stack), std::end(a.stack), std::begin(b.stack)) && a.sp == b.sp
+		&& a.delay_timer == b.delay_timer && a.sound_timer == b.sound_timer
+		&& a.waitingForKey == b.waitingForKey && a.keyWaitRegister == b.keyWaitRegister
+		&& std::equal(std::begin(a.screen), std::end(a.screen), std::begin(b.screen))
+		&& a.displayGeneration == b.displayGeneration;
+}
+
+namespace {
+
+// Binary snapshot layout, every field little-endian:
+//	"C8SS", version, flags, hash of memory below START_ADDRESS,
+//	V0-VF, I, pc, stack, sp, delay timer, sound timer, keypad (bit k for key k), waiting on Fx0A,
+//	Fx0A register, keys pressed during the wait, current opcode, screen rows, display generation, RND state,
+//	length of the program memory kept, that memory, then the memory below START_ADDRESS when flagged
+const uint8_t SAVE_STATE_MAGIC[4] = { 'C', '8', 'S', 'S' };
+constexpr uint16_t SAVE_STATE_LOW_MEMORY = 1u; // Memory below START_ADDRESS is not the stock font image and is stored
+
+// Memory below START_ADDRESS as the constructor leaves it
+void stockLowMemory(uint8_t* low) {
+	std::fill_n(low, START_ADDRESS, (uint8_t)0);
+	std::copy(std::begin(fontset), std::end(fontset), low + FONTSET_START_ADDRESS);
+}
+
+uint64_t hashBytes(const uint8_t* data, size_t size) {
+	Fnv1a fnv;
+	fnv.Mix(data, size);
+	return fnv.hash;
+}
+
+struct StateWriter {
+	std::vector<uint8_t>& out;
+
+	template <typename T>
+	void Put(T value) {
+		for (unsigned int i = 0; i < sizeof(T); i++) out.push_back((uint8_t)((uint64_t)value >> (8u * i)));
+	}
+
+	void Bytes(const uint8_t* data, size_t size) {
+		out.insert(out.end(), data, data + size);
+	}
+};
+
+// Reads past the end return zeros and clear ok
+struct StateReader {
+	const uint8_t* data;
+	size_t size;
+	size_t position = 0;
+	bool ok = true;
+
+	template <typename T>
+	T Get() {
+		if (size - position < sizeof(T)) {
+			ok = false;
+			return T{};
+		}
+		uint64_t value = 0;
+		for (unsigned int i = 0; i < sizeof(T); i++) value |= (uint64_t)data[position++] << (8u * i);
+		return (T)value;
+	}
+
+	const uint8_t* Bytes(size_t count) {
+		if (size - position < count) {
+			ok = false;
+			return nullptr;
+		}
+		position += count;
+		return data + position - count;
+	}
+};
+
+} // namespace
+
+std::vector<uint8_t> Chip8::SaveState() const {
+	uint8_t stock[START_ADDRESS];
+	stockLowMemory(stock);
+	bool lowMemory = !std::equal(memory, memory + START_ADDRESS, stock);
+	uint16_t length = sizeof(memory) - START_ADDRESS;
+	while (length > 0 && memory[START_ADDRESS + length - 1] == 0) length--;
+
+	std::vector<uint8_t> data;
+	data.reserve(512 + length + (lowMemory ? START_ADDRESS : 0));
+	StateWriter out{ data };
+	out.Bytes(SAVE_STATE_MAGIC, sizeof(SAVE_STATE_MAGIC));
+	out.Put(SAVE_STATE_VERSION);
+	out.Put<uint16_t>(lowMemory ? SAVE_STATE_LOW_MEMORY : 0u);
+	out.Put(hashBytes(memory, START_ADDRESS));
+
+	for (uint8_t value : registers) out.Put(value);
+	out.Put(index);
+	out.Put(pc);
+	for (uint16_t value : stack) out.Put(value);
+	out.Put(sp);
+	out.Put(delay_timer);
+	out.Put(sound_timer);
+	uint16_t keys = 0;
+	for (unsigned int key = 0; key < 16; key++) keys |= (uint16_t)((keypad[key] != 0) << key);
+	out.Put(keys);
+	out.Put<uint8_t>(waitingForKey);
+	out.Put(keyWaitRegister);
+	out.Put(keyWaitPressed);
+	out.Put(opcode);
+	for (uint64_t row : screen) out.Put(row);
+	out.Put(displayGeneration);
+	out.Put(rng.state);
+
+	out.Put(length);
+	out.Bytes(&memory[START_ADDRESS], length);
+	if (lowMemory) out.Bytes(memory, START_ADDRESS);
+	return data;
+}
+
+bool Chip8::LoadState(const uint8_t* data, size_t size) {
+	StateReader in{ data, size };
+	const uint8_t* magic = in.Bytes(sizeof(SAVE_STATE_MAGIC));
+	if (magic == nullptr || !std::equal(magic, magic + sizeof(SAVE_STATE_MAGIC), SAVE_STATE_MAGIC)) return false;
+	if (in.Get<uint16_t>() != SAVE_STATE_VERSION) return false;
+	uint16_t flags = in.Get<uint16_t>();
+	uint64_t lowHash = in.Get<uint64_t>();
+
+	Chip8State state;
+	for (uint8_t& value : state.registers) value = in.Get<uint8_t>();
+	state.index = in.Get<uint16_t>();
+	state.pc = in.Get<uint16_t>();
+	for (uint16_t& value : state.stack) value = in.Get<uint16_t>();
+	state.sp = in.Get<uint8_t>();
+	state.delay_timer = in.Get<uint8_t>();
+	state.sound_timer = in.Get<uint8_t>();
+	uint16_t keys = in.Get<uint16_t>();
+	for (unsigned int key = 0; key < 16; key++) state.keypad[key] = (keys >> key) & 1u;
+	state.waitingForKey = in.Get<uint8_t>() != 0;
+	state.keyWaitRegister = in.Get<uint8_t>();
+	state.keyWaitPressed = in.Get<uint16_t>();
+	state.opcode = in.Get<uint16_t>();
+	for (uint64_t& row : state.screen) row = in.Get<uint64_t>();
+	state.displayGeneration = in.Get<uint64_t>();
+	state.rng.state = in.Get<uint64_t>();
+
+	uint16_t length = in.Get<uint16_t>();
+	if (!in.ok || length > sizeof(state.memory) - START_ADDRESS || state.sp > 16 || state.keyWaitRegister > 0xF) return false;
+	const uint8_t* program = in.Bytes(length);
+	const uint8_t* low = (flags & SAVE_STATE_LOW_MEMORY) ? in.Bytes(START_ADDRESS) : nullptr;
+	if (!in.ok || in.position != size) return false;
+
+	if (low != nullptr) std::copy(low, low + START_ADDRESS, state.memory);
+	else stockLowMemory(state.memory);
+	if (hashBytes(state.memory, START_ADDRESS) != lowHash) return false; // Corrupt, or saved by a build with another font
+	std::copy(program, program + length, &state.memory[START_ADDRESS]);
+
+	LoadState(state);
+	return true;
+}
+
+void printOpcodeProfile(const OpcodeProfile& profile, std::ostream& out) {
+	uint64_t overhead = ~(uint64_t)0; // What a timing of nothing reads, taken off every sample
+	for (int i = 0; i < 1000; i++) {
+		uint64_t start = profileTimestamp();
+		overhead = std::min(overhead, profileTimestamp() - start);
+	}
+
+	double estimated[OPID_COUNT]{};	// Ticks spent in each handler, extrapolated from its samples
+	double totalTicks = 0;
+	uint64_t total = 0, timed = 0;
+	uint8_t order[OPID_COUNT];
+	for (unsigned int id = 0; id < OPID_COUNT; id++) {
+		order[id] = (uint8_t)id;
+		if (profile.samples[id] != 0) {
+			double perExecution = std::max((double)profile.ticks[id] / profile.samples[id] - (double)overhead, 0.0);
+			estimated[id] = perExecution * (double)profile.counts[id];
+		}
+		totalTicks += estimated[id];
+		total += profile.counts[id];
+		timed += profile.samples[id];
+	}
+	std::sort(std::begin(order), std::end(order), [&](uint8_t a, uint8_t b) { return profile.counts[a] > profile.counts[b]; });
+
+	std::ios_base::fmtflags flags = out.flags();
+	char fill = out.fill(' ');
+	out << "Opcode profile: " << total << " instructions, " << timed << " timed (" << (CHIP8_HAS_RDTSC ? "TSC ticks" : "ns")
+		<< ", " << overhead << " of timer overhead taken off)\n"
+		<< "handler         count   share   per instr   time share\n" << std::fixed;
+	for (uint8_t id : order) {
+		if (profile.counts[id] == 0) break;
+		out << std::left << std::setw(7) << OPCODE_NAMES[id] << std::right
+			<< std::setw(14) << profile.counts[id]
+			<< std::setw(7) << std::setprecision(2) << 100.0 * profile.counts[id] / total << "%";
+		if (profile.samples[id] != 0) {
+			out << std::setw(12) << std::setprecision(1) << estimated[id] / profile.counts[id]
+				<< std::setw(12) << std::setprecision(2) << (totalTicks > 0 ? 100.0 * estimated[id] / totalTicks : 0.0) << "%";
+		}
+		out << "\n";
+	}
+	out.flags(flags);
+	out.fill(fill);
+	out << std::flush;
+}
+
+const char* backendName(Backend backend) {
+	switch (backend) {
+	case Backend::Switch: return "switch";
+	case Backend::Threaded: return "threaded";
+	case Backend::Predecoded: return "predecoded";
+	case Backend::Blocks: return "blocks";
+	case Backend::Jit: return "jit";
+	default: return "table";
+	}
+}
+
+bool parseBackend(const std::string& name, Backend& backend) {
+	for (Backend candidate : { Backend::Table, Backend::Switch, Backend::Threaded, Backend::Predecoded, Backend::Blocks, Backend::Jit }) {
+		if (name == backendName(candidate)) {
+			backend = candidate;
+			return true;
+		}
+	}
+	return false;
+}
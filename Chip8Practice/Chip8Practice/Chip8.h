@@ -0,0 +1,1303 @@
+/*
+Chip-8 Emulator -- CPU core
+Everything that runs a Chip-8 program and nothing that displays it, shared by the
+emulator (main.cpp), the headless runner (Headless.cpp), the verifier (Verify.cpp) and
+the translation units generated by chip8_aot (Recompiler.h). Built as the chip8_core
+library, no SDL here.
+*/
+
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <bitset>
+#include <type_traits>
+#include <iosfwd>
+#include "Jit.h"
+#include "PcProfile.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define CHIP8_HAS_RDTSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CHIP8_HAS_RDTSC 1
+#else
+#include <chrono>
+#define CHIP8_HAS_RDTSC 0
+#endif
+
+constexpr uint16_t START_ADDRESS = 0x200; // Starting address for Chip8 programs
+constexpr unsigned int FONTSET_SIZE = 80; // The font set size
+constexpr unsigned int FONTSET_START_ADDRESS = 0x50; // Start address for writing font data
+// The bytes representing each character in binary
+constexpr uint8_t fontset[FONTSET_SIZE] = {
+	0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+	0x20, 0x60, 0x20, 0x20, 0x70, // 1
+	0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+	0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+	0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+	0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+	0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+	0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+	0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+	0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+	0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+	0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+	0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+	0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+	0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+	0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+};
+
+// Interface for anything that can feed RND (Cxkk) with bytes
+class RandomSource {
+public:
+	virtual ~RandomSource() = default;
+	virtual uint8_t NextByte() = 0;
+};
+
+// PCG32 (XSH RR) engine, 8 bytes of state, seeded once per Chip8 instance
+class Pcg32Random {
+public:
+	uint64_t state{};
+
+	void Seed(uint64_t seed) {
+		state = 0u;
+		Next();
+		state += seed;
+		Next();
+	}
+
+	uint32_t Next() {
+		uint64_t old = state;
+		state = old * 6364136223846793005ULL + 1442695040888963407ULL;
+		uint32_t xorShifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+		uint32_t rot = (uint32_t)(old >> 59u);
+		return (xorShifted >> rot) | (xorShifted << ((0u - rot) & 31u));
+	}
+
+	uint8_t NextByte() {
+		return (uint8_t)(Next() >> 24u); // High bits are the strongest
+	}
+};
+
+// Replays a fixed byte sequence (wrapping around), handy to script RND results
+class ScriptedRandom : public RandomSource {
+public:
+	explicit ScriptedRandom(std::vector<uint8_t> bytes) : bytes(std::move(bytes)) {}
+
+	uint8_t NextByte() override {
+		if (bytes.empty()) return 0;
+		uint8_t value = bytes[position];
+		position = (position + 1) % bytes.size();
+		return value;
+	}
+private:
+	std::vector<uint8_t> bytes;
+	size_t position{};
+};
+
+// Every instruction handler, in dispatch id order (NULL covers unknown opcodes)
+#define CHIP8_OPCODES(X) \
+	X(NULL) \
+	X(00E0) X(00EE) X(1nnn) X(2nnn) X(3xkk) X(4xkk) X(5xy0) X(6xkk) X(7xkk) \
+	X(8xy0) X(8xy1) X(8xy2) X(8xy3) X(8xy4) X(8xy5) X(8xy6) X(8xy7) X(8xyE) \
+	X(9xy0) X(Annn) X(Bnnn) X(Cxkk) X(Dxyn) X(Ex9E) X(ExA1) \
+	X(Fx07) X(Fx0A) X(Fx15) X(Fx18) X(Fx1E) X(Fx29) X(Fx33) X(Fx55) X(Fx65)
+
+// Dispatch ids of the handlers
+enum OpId : uint8_t {
+#define CHIP8_OPID(name) OPID_##name,
+	CHIP8_OPCODES(CHIP8_OPID)
+#undef CHIP8_OPID
+	OPID_COUNT
+};
+
+// Maps an opcode to its handler, same decoding as the original table/table0/8/E/F scheme
+constexpr uint8_t decodeOpcode(uint16_t opcode) {
+	switch ((opcode & 0xF000u) >> 12u) {
+	case 0x0:
+		switch (opcode & 0x000Fu) {
+		case 0x0: return OPID_00E0;
+		case 0xE: return OPID_00EE;
+		default: return OPID_NULL;
+		}
+	case 0x1: return OPID_1nnn;
+	case 0x2: return OPID_2nnn;
+	case 0x3: return OPID_3xkk;
+	case 0x4: return OPID_4xkk;
+	case 0x5: return OPID_5xy0;
+	case 0x6: return OPID_6xkk;
+	case 0x7: return OPID_7xkk;
+	case 0x8:
+		switch (opcode & 0x000Fu) {
+		case 0x0: return OPID_8xy0;
+		case 0x1: return OPID_8xy1;
+		case 0x2: return OPID_8xy2;
+		case 0x3: return OPID_8xy3;
+		case 0x4: return OPID_8xy4;
+		case 0x5: return OPID_8xy5;
+		case 0x6: return OPID_8xy6;
+		case 0x7: return OPID_8xy7;
+		case 0xE: return OPID_8xyE;
+		default: return OPID_NULL;
+		}
+	case 0x9: return OPID_9xy0;
+	case 0xA: return OPID_Annn;
+	case 0xB: return OPID_Bnnn;
+	case 0xC: return OPID_Cxkk;
+	case 0xD: return OPID_Dxyn;
+	case 0xE:
+		switch (opcode & 0x000Fu) {
+		case 0x1: return OPID_ExA1;
+		case 0xE: return OPID_Ex9E;
+		default: return OPID_NULL;
+		}
+	default:
+		switch (opcode & 0x00FFu) {
+		case 0x07: return OPID_Fx07;
+		case 0x0A: return OPID_Fx0A;
+		case 0x15: return OPID_Fx15;
+		case 0x18: return OPID_Fx18;
+		case 0x1E: return OPID_Fx1E;
+		case 0x29: return OPID_Fx29;
+		case 0x33: return OPID_Fx33;
+		case 0x55: return OPID_Fx55;
+		case 0x65: return OPID_Fx65;
+		default: return OPID_NULL;
+		}
+	}
+}
+
+// Handler names by dispatch id ("00E0", "Dxyn", ...)
+inline constexpr const char* OPCODE_NAMES[OPID_COUNT] = {
+#define CHIP8_NAME(name) #name,
+	CHIP8_OPCODES(CHIP8_NAME)
+#undef CHIP8_NAME
+};
+
+// Whether a basic block has to end with this instruction: anything that changes pc, can modify code or waits
+constexpr bool endsBasicBlock(uint8_t id) {
+	switch (id) {
+	case OPID_00EE: case OPID_1nnn: case OPID_2nnn: case OPID_Bnnn:
+	case OPID_3xkk: case OPID_4xkk: case OPID_5xy0: case OPID_9xy0:
+	case OPID_Ex9E: case OPID_ExA1:
+	case OPID_Fx0A: case OPID_Fx33: case OPID_Fx55:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Whether an instruction writes nothing but registers, I and pc and reads nothing but those, memory, the delay
+// timer and the keypad: a loop made of these alone that comes back to the same registers is waiting, every further
+// iteration does the same until the timer ticks or a key changes (see Chip8::skipIdleLoop)
+constexpr bool isIdleSafe(uint8_t id) {
+	switch (id) {
+	case OPID_NULL: case OPID_1nnn:
+	case OPID_3xkk: case OPID_4xkk: case OPID_5xy0: case OPID_9xy0:
+	case OPID_6xkk: case OPID_7xkk:
+	case OPID_8xy0: case OPID_8xy1: case OPID_8xy2: case OPID_8xy3: case OPID_8xy4:
+	case OPID_8xy5: case OPID_8xy6: case OPID_8xy7: case OPID_8xyE:
+	case OPID_Annn: case OPID_Ex9E: case OPID_ExA1:
+	case OPID_Fx07: case OPID_Fx1E: case OPID_Fx29: case OPID_Fx65:
+		return true;
+	default:
+		return false;
+	}
+}
+
+constexpr unsigned int MAX_IDLE_LOOP = 16; // Instructions per iteration of a loop Run() recognizes as idle
+
+// Dispatch ids keyed by (high nibble, low byte) of the opcode, which is all the decoding looks at.
+// 4 KB built at compile time and shared by every Chip8 instance.
+struct DecodeTable {
+	uint8_t ids[16 * 256];
+};
+
+constexpr DecodeTable buildDecodeTable() {
+	DecodeTable table{};
+	for (unsigned int key = 0; key < 16 * 256; key++) {
+		table.ids[key] = decodeOpcode((uint16_t)(((key & 0xF00u) << 4u) | (key & 0x0FFu)));
+	}
+	return table;
+}
+
+inline constexpr DecodeTable DECODE_TABLE = buildDecodeTable();
+
+// Superinstructions, dispatch ids past the regular handlers for pairs fused by the block cache
+enum SuperOpId : uint8_t {
+	SUPER_6xkk_6xkk = OPID_COUNT + 1,	// LD Vx, byte; LD Vy, byte
+	SUPER_Annn_Dxyn,					// LD I, addr; DRW Vx, Vy, nibble
+	SUPER_7xkk_3xkk						// ADD Vx, byte; SE Vy, byte
+};
+
+// One entry of a basic block, a single instruction or a fused pair
+struct BlockOp {
+	uint16_t opcode;
+	uint16_t opcode2;	// Second instruction of a superinstruction
+	uint8_t id;			// Dispatch id or SuperOpId
+};
+
+// Straight-line run of instructions ending at a jump, call, return, skip, store or key wait
+struct BasicBlock {
+	uint32_t firstOp;	// Index of the first op in BlockCache::ops
+	uint8_t opCount;	// Ops, after fusing
+	uint8_t length;		// Instructions covered (and cycles taken), the block spans length * 2 bytes
+};
+
+constexpr unsigned int MAX_BLOCK_LENGTH = 32; // Instructions per basic block
+
+// Blocks discovered so far, keyed by start address. Any write into an address covered by a
+// block flushes the whole cache, self-modifying code is rare enough for that to be cheap.
+struct BlockCache {
+	static constexpr uint16_t NO_BLOCK = 0xFFFFu;
+
+	uint16_t blockAt[4096 / 2];	// Block starting at each even address, or NO_BLOCK
+	std::bitset<4096> covered;	// Addresses read by a cached block
+	std::vector<BasicBlock> blocks;
+	std::vector<BlockOp> ops;
+
+	BlockCache() {
+		Clear();
+	}
+
+	void Clear() {
+		std::fill(std::begin(blockAt), std::end(blockAt), NO_BLOCK);
+		covered.reset();
+		blocks.clear();
+		ops.clear();
+	}
+
+	void Invalidate(uint16_t address, unsigned int size) {
+		for (unsigned int i = address; i < address + size && i < covered.size(); i++) {
+			if (covered[i]) {
+				Clear();
+				return;
+			}
+		}
+	}
+};
+
+// Owns a cache that is only allocated when used. Copies start out empty, the cache can always be rebuilt from memory.
+template <typename T>
+class LazyCache {
+public:
+	LazyCache() = default;
+	LazyCache(const LazyCache&) {}
+	LazyCache& operator=(const LazyCache&) {
+		cache.reset();
+		return *this;
+	}
+
+	T& Get() {
+		if (!cache) cache = std::make_unique<T>();
+		return *cache;
+	}
+
+	T* Peek() const {
+		return cache.get();
+	}
+private:
+	std::unique_ptr<T> cache;
+};
+
+constexpr uint8_t SCREEN_WIDTH = 64;
+constexpr uint8_t SCREEN_HEIGHT = 32;
+
+constexpr unsigned int FRAME_RATE = 60;					// Timer (and frame) frequency in Hz
+constexpr unsigned int DEFAULT_INSTRUCTIONS_PER_FRAME = 11;	// About 660 instructions per second
+
+constexpr uint16_t SAVE_STATE_VERSION = 1;					// Version written by Chip8::SaveState(), bumped on any layout change
+
+// Interpreter cores, selectable at run time through Chip8::backend
+enum class Backend : uint8_t {
+	Table,		// Pointer-to-member dispatch through HANDLERS (what Cycle() does)
+	Switch,		// Single switch over the dispatch id with every handler inlined
+	Threaded,	// Computed goto threaded code (falls back to Switch without GCC/Clang)
+	Predecoded,	// Runs from a cache of decoded instructions, invalidated by stores into memory
+	Blocks,		// Runs cached straight-line basic blocks, with common pairs fused into superinstructions
+	Jit			// Translates basic blocks to x86-64 (Blocks on other hosts)
+};
+
+// Cached decoding of the instruction at an even address
+struct DecodedInstruction {
+	uint16_t opcode = 0;		// Operands are extracted from it by the handler, a couple of masks
+	uint8_t id = OPID_COUNT;	// Dispatch id, OPID_COUNT until decoded (or after the memory underneath is written)
+};
+
+constexpr uint32_t PROFILE_SAMPLE_INTERVAL = 32; // Executions per timed one in an OpcodeProfile, on average
+
+// Cheapest clock there is for timing a single handler: the TSC on x86, steady_clock nanoseconds elsewhere
+inline uint64_t profileTimestamp() {
+#if CHIP8_HAS_RDTSC
+	return __rdtsc();
+#else
+	return (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+// Per handler execution counts and timings, collected by Run() while Chip8::opcodeProfile points to one.
+// Every execution is counted; about one in PROFILE_SAMPLE_INTERVAL is timed, timing them all would cost
+// more than most handlers take.
+struct OpcodeProfile {
+	uint64_t counts[OPID_COUNT]{};
+	uint64_t samples[OPID_COUNT]{};		// Timed executions
+	uint64_t ticks[OPID_COUNT]{};		// Their total, timer overhead included
+	uint32_t countdown = 1;				// Executions until the next timed one
+	uint32_t sampleSeed = 1;
+
+	// Random intervals, so that a loop does not get the same instruction timed every time round
+	uint32_t NextInterval() {
+		sampleSeed = sampleSeed * 1103515245u + 12345u;
+		return 1 + (sampleSeed >> 16u) % (2 * PROFILE_SAMPLE_INTERVAL - 1);
+	}
+};
+
+// Everything a running program can see or change, plain data so a snapshot is a single copy
+struct Chip8State {
+	uint8_t registers[16]{};	// 16 8-bit registers (2^4)
+	
+	uint8_t memory[4096]{};		// 4K of memory (2^12)
+	uint16_t index{};			// 16-bit index register
+	uint16_t pc{};				// 16-bit program counter
+
+	uint16_t stack[16]{};		// 16 levels of stack (2^4)
+	uint8_t sp{};				// Stack pointer
+
+	uint8_t delay_timer{};		// 8-bit delay timer
+	uint8_t sound_timer{};		// 8-bit sound timer
+
+	uint8_t keypad[16]{};		// 16 keys (2^4)
+	bool waitingForKey{};		// Stopped on Fx0A until KeyEvent() delivers a key, no instruction runs meanwhile
+	uint8_t keyWaitRegister{};	// Vx of the pending Fx0A
+	uint16_t keyWaitPressed{};	// Keys pressed since the wait began, bit k for key k
+
+	uint64_t screen[32]{};		// 64x32 monochrome screen, one 64-bit word per row (bit 63 is the leftmost pixel)
+	uint64_t displayGeneration{};	// Bumped whenever the screen content changes (00E0, Dxyn)
+	uint32_t dirtyRows{ ~0u };	// Rows changed since the frontend last cleared it, bit y for row y (all of them before the first present)
+	uint16_t opcode{};			// Current opcode
+	Pcg32Random rng{};			// Per-instance RND engine
+};
+
+static_assert(std::is_trivially_copyable<Chip8State>::value, "Snapshots are plain copies of Chip8State");
+
+class Chip8 : public Chip8State {
+public:
+	Chip8();
+	explicit Chip8(uint64_t seed);
+
+	Backend backend{};					// Interpreter core used by Run()
+	DecodedInstruction decoded[4096 / 2];	// Predecode cache, one record per even address
+	LazyCache<BlockCache> blockCache;		// Basic blocks for Backend::Blocks
+	LazyCache<JitCache> jitCache;			// Native code for Backend::Jit
+
+	RandomSource* randomSource{};		// Optional override of rng (scripted streams, benchmarks)
+	OpcodeProfile* opcodeProfile{};		// When set, Run() counts and times every handler on the switch core (no idle loop skipping)
+	PcProfile* pcProfile{};				// Same, counting the instructions run at every address and under every call path
+
+	bool skipIdleLoops = true;			// Let Run() skip the iterations of loops that only wait for the timer or a key
+	uint8_t idleLoopLength{};			// Instructions per iteration of the idle loop the last Run() ended in, 0 if none
+	bool idleLoopReadsTimer{};			// That loop reads the delay timer (Fx07), so it only stays idle within a frame
+	uint64_t idleCyclesSkipped{};		// Cycles skipped in idle loops so far, for statistics
+
+	// Seeds the RND engine, a fixed seed makes a run reproducible
+	void Seed(uint64_t seed) {
+		rng.Seed(seed);
+	}
+
+	// Plugs in another byte source for RND (nullptr goes back to the built-in engine)
+	void SetRandomSource(RandomSource* source) {
+		randomSource = source;
+	}
+
+	uint8_t genRand() {
+		if (randomSource != nullptr) return randomSource->NextByte();
+		return rng.NextByte();
+	}
+
+	// ************ INSTRUCTIONS ************
+	// CLS - 00E0 - Clear the display
+	void OP_00E0() {
+		std::fill(std::begin(screen), std::end(screen), 0);
+		++displayGeneration;
+		dirtyRows = ~0u;
+	}
+
+	// RET - 00EE - Return from a subroutine
+	void OP_00EE() {
+		pc = stack[--sp];
+	}
+	
+	// JP addr - Jump to location nnn
+	void OP_1nnn() {
+		uint16_t address = opcode & 0x0FFFu;
+		pc = address;
+	}
+
+	// CALL addr - 2nnn - Call subroutine at nnn
+	void OP_2nnn() {
+		stack[sp++] = pc;
+		uint16_t jmpAddress = opcode & 0x0FFFu;
+		pc = jmpAddress;
+	}
+
+	// SE Vx, byte - 3xkk - Skip next instruction if Vx == kk
+	void OP_3xkk() {
+		uint8_t regX = (opcode & 0x0F00u) >> 8u; // Which register to compare
+		uint8_t valueToCompare = (opcode & 0x00FFu);
+
+		if (registers[regX] == valueToCompare) { // Values are equal, increment pc by 2
+			pc += 2;
+		}
+	}
+
+	// SNE Vx, byte - 4xkk - Skip next instruction if Vx != kk
+	void OP_4xkk() {
+		uint8_t regX = (opcode & 0x0F00u) >> 8u; // Which register to compare
+		uint8_t valueToCompare = (opcode & 0x00FFu);
+
+		if (registers[regX] != valueToCompare) // Values are not equal, increment pc by 2
+			pc += 2;
+	}
+
+	// SE Vx, Vy - 5xy0 - Skip next instruction if Vx == Vy
+	void OP_5xy0() {
+		uint8_t regX = (opcode & 0x0F00u) >> 8u; // Index of register X
+		uint8_t regY = (opcode & 0x00F0u) >> 4u; // Index of register Y
+
+		if (registers[regX] == registers[regY])
+			pc += 2;
+	}
+
+	// LD Vx, byte - 6xkk - The interpreter puts the value kk into register Vx
+	void OP_6xkk() {
+		uint8_t regX = (opcode & 0x0F00u) >> 8u;
+		uint8_t value = opcode & 0x00FFu;
+		registers[regX] = value;
+	}
+
+	// ADD Vx, byte - 7xkk - Adds the value kk to the value of register Vx, then stores the result in Vx
+	void OP_7xkk() {
+		uint8_t regX = (opcode & 0x0F00u) >> 8u;
+		uint8_t value = opcode & 0x00FFu;
+		registers[regX] += value;
+	}
+
+	// LD Vx, Vy - 8xy0 - Stores the value of register Vy in register Vx
+	void OP_8xy0() {
+		uint8_t regX = (opcode & 0x0F00u) >> 8u;
+		uint8_t regY = (opcode & 0x00F0u) >> 4u;
+		registers[regX] = registers[regY];
+	}
+
+	// OR Vx, Vy - 8xy1 - Performs a bitwise OR on the values of Vx and Vy, stored in Vx
+	void OP_8xy1() {
+		uint8_t regX = (opcode & 0x0F00u) >> 8u;
+		uint8_t regY = (opcode & 0x00F0u) >> 4u;
+		registers[regX] = registers[regX] | registers[regY];
+	}
+
+	// AND Vx, Vy - 8xy2 - Performs a bitwise AND on the values of Vx and Vy, stored in Vx
+	void OP_8xy2() {
+		uint8_t regX = (opcode & 0x0F00u) >> 8u;
+		uint8_t regY = (opcode & 0x00F0u) >> 4u;
+		registers[regX] = registers[regX] & registers[regY];
+	}
+	
+	// XOR Vx, Vy - 8xy3 - Performs a bitwise XOR on the values of Vx and Vy, stored in Vx
+	void OP_8xy3() {
+		uint8_t regX = (opcode & 0x0F00u) >> 8u;
+		uint8_t regY = (opcode & 0x00F0u) >> 4u;
+		registers[regX] = registers[regX] ^ registers[regY];
+	}
+
+	// ADD Vx, Vy | 8xy4 | Performs a bitwise AND on the values of Vx and Vy, stored in Vx
+	void OP_8xy4() {
+		uint8_t regX = (opcode & 0x0F00u) >> 8u;
+		uint8_t regY = (opcode & 0x00F0u) >> 4u;
+		uint16_t result = registers[regX] + registers[regY]; // So we can check for carry
+		if (result > 255u) registers[0xF] = 1;	// Set the carry to 1
+		else registers[0xF] = 0;				// No carry, set it to 0
+		registers[regX] = result & 0x00FFu;
+	}
+
+	// SUB Vx, Vy | 8xy5 | Set Vx = Vx - Vy, set VF = NOT borrow
+	void OP_8xy5() {
+		uint8_t regX = (opcode & 0x0F00u) >> 8u;
+		uint8_t regY = (opcode & 0x00F0u) >> 4u;
+		if (registers[regX] > registers[regY]) registers[0xF] = 1;
+		else registers[0xF] = 0;
+		registers[regX] = registers[regX] - registers[regY];
+	}
+
+	// SHR Vx {, Vy} | 8xy6 | Set Vx = Vx SHR 1
+	void OP_8xy6() {
+		uint8_t regX = (opcode & 0x0F00u) >> 8u;
+		registers[0xF] = registers[regX] & 0x1;
+		registers[regX] >>= 1;
+	}
+
+	// SUBN Vx, Vy | 8xy7 | Set Vx = Vy - Vx, set VF = NOT borrow
+	void OP_8xy7() {
+		uint8_t regX = (opcode & 0x0F00u) >> 8u;
+		uint8_t regY = (opcode & 0x00F0u) >> 4u;
+		if (registers[regX] > registers[regY]) registers[0xF] = 1;
+		else registers[0xF] = 0;
+		registers[regX] = registers[regX] - registers[regY];
+	}
+
+	// SHL Vx {, Vy} | 8xyE | Set Vx = Vx 
+	void OP_8xyE() {
+		uint8_t regX = (opcode & 0x0F00u) >> 8u;
+		registers[0xF] = registers[regX] & 0x1;
+		registers[regX] <<= 1;
+	}
+
+	// SNE Vx, Vy | 9xy0 | Skip next instruction if Vx != Vy
+	void OP_9xy0() {
+		uint8_t regX = (opcode & 0x0F00u) >> 8u;
+		uint8_t regY = (opcode & 0x00F0u) >> 4u;
+		if (registers[regX] != registers[regY])
+			pc += 2;
+	}
+
+	// LD I, addr | Annn | The value of register I is set to nnn
+	void OP_Annn() {
+		uint16_t value = opcode & 0x0FFFu;
+		index = value;
+	}
+
+	// JP V0, addr | Bnnn | Jump to location nnn + V0
+	void OP_Bnnn() {
+		uint16_t value = opcode & 0x0FFFu;
+		pc = value + registers[0x0];
+	}
+
+	// RND Vx, byte | Cxkk | Set Vx = random byte AND kk
+	void OP_Cxkk() {
+		uint8_t regX = (opcode & 0x0F00u) >> 8u;
+		uint8_t randVal = genRand();
+		uint8_t value = opcode & 0x00FF;
+		registers[regX] = randVal & value;
+	}
+
+	// DRW Vx, Vy, nibble | Dxyn | Display n-byte sprite starting at memory location I at (Vx, Vy),  set VF = collision
+	void OP_Dxyn() {
+		uint8_t byteCount = opcode & 0x000Fu;
+		uint8_t regX = (opcode & 0x0F00u) >> 8u;
+		uint8_t regY = (opcode & 0x00F0u) >> 4u;
+		// The sprite starts at wrapped coordinates and is clipped at the right and bottom edges
+		uint8_t xCoord = registers[regX] % SCREEN_WIDTH;
+		uint8_t yCoord = registers[regY] % SCREEN_HEIGHT;
+		unsigned int rowCount = std::min<unsigned int>(byteCount, SCREEN_HEIGHT - yCoord);
+
+		uint64_t collision = 0;
+		uint32_t changedRows = 0;
+		for (unsigned int row = 0; row < rowCount; ++row)
+		{
+			// Sprite byte lined up with column xCoord, whatever goes past column 63 is shifted out
+			uint64_t spriteRow = ((uint64_t)memory[index + row] << 56u) >> xCoord;
+			collision |= screen[yCoord + row] & spriteRow;
+			screen[yCoord + row] ^= spriteRow;
+			changedRows |= (uint32_t)(spriteRow != 0) << (yCoord + row);
+		}
+		registers[0xF] = collision != 0;
+		if (changedRows != 0) {
+			++displayGeneration;
+			dirtyRows |= changedRows;
+		}
+	}
+
+	// SKP Vx | Ex9E | Skip next instruction if key with the value of Vx is pressed
+	void OP_Ex9E() {
+		uint8_t regX = (opcode & 0x0F00u) >> 8u;
+		uint8_t key = registers[regX];
+		if (keypad[key]) pc += 2;
+	}
+	
+	// SKNP Vx | ExA1 | Skip next instruction if key with the value of Vx is not pressed
+	void OP_ExA1() {
+		uint8_t regX = (opcode & 0x0F00u) >> 8u;
+		uint8_t key = registers[regX];
+		if (!keypad[key]) pc += 2;
+	}
+
+	// LD Vx, DT | Fx07 | The value of DT is placed into Vx
+	void OP_Fx07() {
+		uint8_t regX = (opcode & 0x0F00u) >> 8u;
+		registers[regX] = delay_timer;
+	}
+
+	// LD Vx, K | Fx0A | Wait for a key press, store the value of the key in Vx
+	// Puts the CPU in a wait state instead of spinning, KeyEvent() ends it once a key pressed during the wait is released
+	void OP_Fx0A() {
+		keyWaitRegister = (opcode & 0x0F00u) >> 8u;
+		keyWaitPressed = 0;
+		waitingForKey = true;
+	}
+
+	// LD DT, Vx | Fx15 | Set delay timer = Vx
+	void OP_Fx15() {
+		uint8_t regX = (opcode & 0x0F00u) >> 8u;
+		delay_timer = registers[regX];
+	}
+
+	// LD ST, Vx | Fx18 | Set sound timer = Vx
+	void OP_Fx18() {
+		uint8_t regX = (opcode & 0x0F00u) >> 8u;
+		sound_timer = registers[regX];
+	}
+
+	// ADD I, Vx | Fx1E | The values of I and Vx are added, and the results are stored in I
+	void OP_Fx1E() {
+		uint8_t regX = (opcode & 0x0F00u) >> 8u;
+		index += registers[regX];
+	}
+
+	// LD F, Vx | Fx29 | Set I = location of sprite for digit Vx
+	void OP_Fx29() {
+		uint8_t regX = (opcode & 0x0F00u) >> 8u;
+		index = FONTSET_START_ADDRESS + registers[regX] * 5u; // 5 bytes per glyph
+	}
+
+	// LD B, Vx | Fx33 | Store BCD representation of Vx in memory locations I, I+1, and I+2
+	void OP_Fx33() {
+		uint8_t regX = (opcode & 0x0F00u) >> 8u;
+		uint8_t value = registers[regX];
+		uint8_t hundreds = value / 100;
+		uint8_t tens = (value - (hundreds * 100)) / 10;
+		uint8_t ones = (value - (hundreds * 100) - (tens * 10));
+		memory[index] = hundreds;
+		memory[index + 1] = tens;
+		memory[index + 2] = ones;
+		InvalidateCode(index, 3);
+	}
+
+	// LD [I], Vx | Fx55 | Store registers V0 through Vx in memory starting at location I
+	void OP_Fx55() {
+		uint8_t regX = (opcode & 0x0F00u) >> 8u;
+		for (uint8_t i = 0; i <= regX; i++) {
+			memory[index + i] = registers[i];
+		}
+		InvalidateCode(index, regX + 1u);
+	}
+
+	// LD Vx, [I] | Fx65 | Read registers V0 through Vx from memory starting at location I
+	void OP_Fx65() {
+		uint8_t regX = (opcode & 0x0F00u) >> 8u;
+		for (uint8_t i = 0; i <= regX; i++) {
+			registers[i] = memory[index + i];
+		}
+	}
+	
+	void OP_NULL(){}
+	// **************************************
+
+	using Handler = void (Chip8::*)();
+	static const Handler HANDLERS[OPID_COUNT]; // Dispatch id -> handler, shared by every instance
+
+	// Dispatch id of an opcode, a single lookup in the shared decode table
+	static uint8_t Decode(uint16_t opcode) {
+		return DECODE_TABLE.ids[((opcode & 0xF000u) >> 4u) | (opcode & 0x00FFu)];
+	}
+
+	void Cycle() {
+		if (waitingForKey) return; // Halted on Fx0A
+
+		// Fetch
+		opcode = (memory[pc] << 8u) + memory[pc + 1];
+		pc += 2;
+
+		// Decode and Execute
+		(this->*HANDLERS[Decode(opcode)])();
+	}
+
+	// Updates the keypad from the host, completing a pending Fx0A on the release of a key pressed during the wait
+	void KeyEvent(uint8_t key, bool pressed) {
+		keypad[key] = pressed;
+		if (!waitingForKey) return;
+
+		if (pressed) {
+			keyWaitPressed |= 1u << key;
+		}
+		else if (keyWaitPressed & (1u << key)) {
+			registers[keyWaitRegister] = key;
+			waitingForKey = false;
+		}
+	}
+
+	// Counts the delay and sound timers down by one, called once per 60 Hz frame and not per instruction
+	void TickTimers() {
+		if (delay_timer > 0) --delay_timer;
+		if (sound_timer > 0) --sound_timer;
+	}
+
+	// One 60 Hz frame: a fixed number of instructions, then the timer tick
+	void RunFrame(unsigned int instructionsPerFrame) {
+		Run(instructionsPerFrame);
+		TickTimers();
+	}
+
+	// Snapshot of everything the program can see, a single copy of the Chip8State block (cheap enough for every frame)
+	void SaveState(Chip8State& state) const {
+		state = *this;
+	}
+
+	// Restores a snapshot from SaveState(). Only the cached code over memory that differs is dropped,
+	// so going back and forth within one program keeps the caches warm. The whole screen is marked dirty.
+	void LoadState(const Chip8State& state) {
+		unsigned int first = 0;
+		unsigned int last = sizeof(memory);
+		while (first < last && memory[first] == state.memory[first]) first++;
+		while (last > first && memory[last - 1] == state.memory[last - 1]) last--;
+
+		static_cast<Chip8State&>(*this) = state;
+		dirtyRows = ~0u;
+		idleLoopLength = 0;
+		if (first < last) InvalidateCode((uint16_t)first, last - first);
+	}
+
+	// Versioned binary snapshot for files: the packed screen, memory from START_ADDRESS up (trailing zeros
+	// dropped) and a hash of the memory below it, which is only stored when it is not the stock font image
+	std::vector<uint8_t> SaveState() const;
+
+	// Reads a binary snapshot back, false (and the machine untouched) when it is malformed or from another version
+	bool LoadState(const uint8_t* data, size_t size);
+
+	// Drops cached decodings of [address, address + size), must be called after writing to memory
+	void InvalidateCode(uint16_t address, unsigned int size) {
+		unsigned int first = address >> 1u;
+		unsigned int last = std::min((address + size + 1u) >> 1u, (unsigned int)(sizeof(memory) / 2));
+		for (unsigned int i = first; i < last; i++) {
+			decoded[i].id = OPID_COUNT;
+		}
+		if (BlockCache* cache = blockCache.Peek()) cache->Invalidate(address, size);
+		if (JitCache* cache = jitCache.Peek()) cache->Invalidate(address, size);
+	}
+
+	// Runs a number of cycles on the selected interpreter core, same results as calling Cycle() in a loop.
+	// Returns early when the CPU stops on Fx0A (waitingForKey), the rest of the cycles would do nothing.
+	// Returns the number of cycles actually run, iterations of an idle loop skipped by skipIdleLoop() included.
+	uint64_t Run(uint64_t cycles) {
+		if (waitingForKey) return 0;
+
+		if (opcodeProfile != nullptr || pcProfile != nullptr) return cycles - runSwitch<true>(cycles); // Checked once per call, the cores stay as they are
+
+		uint64_t done = skipIdleLoops ? skipIdleLoop(cycles) : 0;
+		if (done < cycles) done += (cycles - done) - runBackend(cycles - done);
+		return done;
+	}
+
+	// Whether Run() left the CPU in an idle loop that nothing but a key event can get out of: frames can then
+	// be skipped with SkipIdleFrames() up to the next event
+	bool IdleAcrossFrames() const {
+		return idleLoopLength != 0 && !idleLoopReadsTimer && !waitingForKey;
+	}
+
+	// Same as that many RunFrame() calls while IdleAcrossFrames(): the iterations all do the same thing, so only
+	// the leftover instructions run (to end at the same place in the loop) and the timers count down
+	void SkipIdleFrames(uint64_t frames, unsigned int instructionsPerFrame) {
+		uint64_t cycles = frames * instructionsPerFrame;
+		uint64_t leftover = cycles % idleLoopLength;
+		for (uint64_t i = 0; i < leftover; i++) execute(fetch());
+		idleCyclesSkipped += cycles - leftover;
+		delay_timer = (uint8_t)(delay_timer > frames ? delay_timer - frames : 0);
+		sound_timer = (uint8_t)(sound_timer > frames ? sound_timer - frames : 0);
+	}
+private:
+	// Whether pc sits in a loop of isIdleSafe() instructions closed by a backward 1nnn, at most MAX_IDLE_LOOP long.
+	// Only looks at the code, skips are assumed not taken.
+	bool inIdleLoopCandidate() const {
+		uint16_t address = pc;
+		for (unsigned int i = 0; i < MAX_IDLE_LOOP && address < sizeof(memory) - 1; i++, address += 2) {
+			uint16_t instruction = (memory[address] << 8u) + memory[address + 1];
+			uint8_t id = Decode(instruction);
+			if (!isIdleSafe(id)) return false;
+			if (id == OPID_1nnn) return (instruction & 0x0FFFu) <= pc;
+		}
+		return false;
+	}
+
+	// Spin waits (a jump to itself, Fx07/3xkk/1nnn polling the delay timer, ExA1/1nnn polling a key) cannot change
+	// anything until the timers tick or a key event comes, which never happens within a Run(). When pc is in such
+	// a loop, runs it once or twice for real until an iteration leaves registers and I as they were, then skips
+	// every further whole iteration that fits in the cycles; the rest of the cycles run normally, so the machine
+	// ends up exactly where stepping would have left it. Returns the cycles used up (run or skipped).
+	uint64_t skipIdleLoop(uint64_t cycles) {
+		idleLoopLength = 0;
+		if (!inIdleLoopCandidate()) return 0;
+
+		uint16_t start = pc;
+		uint64_t done = 0;
+		bool readsTimer = false;
+		for (unsigned int iteration = 0; iteration < 2; iteration++) {
+			uint8_t before[sizeof(registers)];
+			std::memcpy(before, registers, sizeof(registers));
+			uint16_t indexBefore = index;
+			unsigned int length = 0;
+			do {
+				if (done == cycles || length == MAX_IDLE_LOOP || pc >= sizeof(memory) - 1) return done;
+				uint8_t id = Decode((uint16_t)((memory[pc] << 8u) + memory[pc + 1]));
+				if (!isIdleSafe(id)) return done; // Left the loop, or a skip reached something else
+				readsTimer |= id == OPID_Fx07;
+				execute(fetch());
+				done++;
+				length++;
+			} while (pc != start);
+
+			if (index == indexBefore && std::memcmp(before, registers, sizeof(registers)) == 0) {
+				uint64_t skipped = (cycles - done) / length * length;
+				idleLoopLength = (uint8_t)length;
+				idleLoopReadsTimer = readsTimer;
+				idleCyclesSkipped += skipped;
+				return done + skipped;
+			}
+		}
+		return done;
+	}
+
+	// Runs cycles on the selected core, returns the cycles it did not get to run (see the run* cores)
+	uint64_t runBackend(uint64_t cycles) {
+		uint64_t remaining = cycles;
+		switch (backend) {
+		case Backend::Switch: remaining = runSwitch(cycles); break;
+		case Backend::Predecoded: remaining = runPredecoded(cycles); break;
+		case Backend::Threaded: remaining = runThreaded<false>(cycles); break;
+		case Backend::Blocks: remaining = runBlocks(cycles); break;
+		case Backend::Jit: remaining = runJit(cycles); break;
+		default:
+			for (; remaining > 0 && !waitingForKey; remaining--) Cycle();
+			break;
+		}
+		return remaining;
+	}
+
+	// One dense switch over the dispatch id, the handlers get inlined into the caller
+	void execute(uint8_t id) {
+		switch (id) {
+#define CHIP8_CASE(name) case OPID_##name: OP_##name(); break;
+			CHIP8_OPCODES(CHIP8_CASE)
+#undef CHIP8_CASE
+		}
+	}
+
+	// Fetches the instruction at pc into opcode, returns its dispatch id
+	uint8_t fetch() {
+		opcode = (memory[pc] << 8u) + memory[pc + 1];
+		pc += 2;
+		return Decode(opcode);
+	}
+
+	// Same as fetch() but through the predecode cache, decoding each even address once
+	uint8_t fetchPredecoded() {
+		if ((pc & 0xF001u) != 0) return fetch(); // Odd or out of range pc, decode on the spot
+
+		DecodedInstruction& entry = decoded[pc >> 1u];
+		if (entry.id == OPID_COUNT) {
+			entry.opcode = (memory[pc] << 8u) + memory[pc + 1];
+			entry.id = Decode(entry.opcode);
+		}
+		opcode = entry.opcode;
+		pc += 2;
+		return entry.id;
+	}
+
+	// The run* cores return the cycles they did not get to run (only ever non-zero after Fx0A).
+	// Profiled fills in opcodeProfile and pcProfile (either may be null), the plain instantiation has no trace of them.
+	template <bool Profiled = false>
+	uint64_t runSwitch(uint64_t cycles) {
+		if constexpr (Profiled) {
+			if (pcProfile != nullptr) pcProfile->Enter(stack, sp, memory);
+		}
+		for (; cycles > 0; cycles--) {
+			if constexpr (Profiled) {
+				if (pcProfile != nullptr) pcProfile->Count(pc, stack, sp, memory);
+			}
+			uint8_t id = fetch();
+			if constexpr (Profiled) {
+				if (opcodeProfile != nullptr) executeProfiled(id);
+				else execute(id);
+			}
+			else {
+				execute(id);
+			}
+			if (id == OPID_Fx0A) return cycles - 1; // Always enters the key wait
+		}
+		return 0;
+	}
+
+	// execute() counted in opcodeProfile, timed when the sampling countdown runs out
+	void executeProfiled(uint8_t id) {
+		OpcodeProfile& profile = *opcodeProfile;
+		profile.counts[id]++;
+		if (--profile.countdown == 0) {
+			uint64_t start = profileTimestamp();
+			execute(id);
+			profile.ticks[id] += profileTimestamp() - start;
+			profile.samples[id]++;
+			profile.countdown = profile.NextInterval();
+		}
+		else {
+			execute(id);
+		}
+	}
+
+	// Runs from the predecode cache until a store invalidates it, threaded when computed goto is available
+	uint64_t runPredecoded(uint64_t cycles) {
+#if defined(__GNUC__)
+		return runThreaded<true>(cycles);
+#else
+		for (; cycles > 0; cycles--) {
+			uint8_t id = fetchPredecoded();
+			execute(id);
+			if (id == OPID_Fx0A) return cycles - 1;
+		}
+		return 0;
+#endif
+	}
+
+	// Superinstruction for a pair of instructions, 0 if they do not fuse
+	static uint8_t fusedId(uint8_t first, uint8_t second) {
+		if (first == OPID_6xkk && second == OPID_6xkk) return SUPER_6xkk_6xkk;
+		if (first == OPID_Annn && second == OPID_Dxyn) return SUPER_Annn_Dxyn;
+		if (first == OPID_7xkk && second == OPID_3xkk) return SUPER_7xkk_3xkk;
+		return 0;
+	}
+
+	// Discovers the basic block starting at an even address and adds it to the cache
+	const BasicBlock& compileBlock(BlockCache& cache, uint16_t start) {
+		BasicBlock block{ (uint32_t)cache.ops.size(), 0, 0 };
+		bool previousFusable = false; // Whether the last op is still a single instruction
+
+		for (unsigned int address = start; address + 1 < sizeof(memory) && block.length < MAX_BLOCK_LENGTH; address += 2) {
+			uint16_t instruction = (memory[address] << 8u) + memory[address + 1];
+			uint8_t id = Decode(instruction);
+			block.length++;
+
+			uint8_t fused = previousFusable ? fusedId(cache.ops.back().id, id) : 0;
+			if (fused != 0) {
+				cache.ops.back().id = fused;
+				cache.ops.back().opcode2 = instruction;
+				previousFusable = false;
+			}
+			else {
+				cache.ops.push_back(BlockOp{ instruction, 0, id });
+				block.opCount++;
+				previousFusable = true;
+			}
+
+			if (endsBasicBlock(id)) break;
+		}
+
+		for (unsigned int address = start; address < start + block.length * 2u && address < cache.covered.size(); address++) {
+			cache.covered[address] = true;
+		}
+		cache.blockAt[start >> 1u] = (uint16_t)cache.blocks.size();
+		cache.blocks.push_back(block);
+		return cache.blocks.back();
+	}
+
+	// Runs whole basic blocks while they fit in the remaining cycles
+	uint64_t runBlocks(uint64_t cycles) {
+		BlockCache& cache = blockCache.Get();
+
+		while (cycles > 0) {
+			if ((pc & 0xF001u) != 0) { // Odd or out of range pc, no block there
+				execute(fetch());
+				cycles--;
+				if (waitingForKey) return cycles;
+				continue;
+			}
+
+			uint16_t slot = cache.blockAt[pc >> 1u];
+			BasicBlock block = slot != BlockCache::NO_BLOCK ? cache.blocks[slot] : compileBlock(cache, pc);
+			if (block.length > cycles) { // Not enough cycles left for the whole block, finish one at a time
+				for (; cycles > 0 && !waitingForKey; cycles--) {
+					execute(fetchPredecoded());
+				}
+				return cycles;
+			}
+
+			// Only the last instruction of a block can observe pc, so it is set once up front
+			pc += block.length * 2u;
+			cycles -= block.length;
+
+			const BlockOp* op = &cache.ops[block.firstOp];
+			const BlockOp* end = op + block.opCount;
+			for (; op != end; op++) { // The last op may be a store that flushes the cache, op is never read after it
+				opcode = op->opcode;
+				switch (op->id) {
+#define CHIP8_CASE(name) case OPID_##name: OP_##name(); break;
+					CHIP8_OPCODES(CHIP8_CASE)
+#undef CHIP8_CASE
+				case SUPER_6xkk_6xkk:
+					OP_6xkk();
+					opcode = op->opcode2;
+					OP_6xkk();
+					break;
+				case SUPER_Annn_Dxyn:
+					OP_Annn();
+					opcode = op->opcode2;
+					OP_Dxyn();
+					break;
+				case SUPER_7xkk_3xkk:
+					OP_7xkk();
+					opcode = op->opcode2;
+					OP_3xkk();
+					break;
+				}
+			}
+			if (waitingForKey) return cycles; // The block ended on Fx0A
+		}
+		return 0;
+	}
+
+	// Translates the block at start to x86-64, stopping before the first instruction it does not handle
+	// (draws, stores, RND, timers, key waits, ...) which is then left to the interpreter
+	JitBlock compileJitBlock(JitCache& cache, uint16_t start) {
+		auto offsetOf = [this](const void* field) { return (int32_t)((const uint8_t*)field - (const uint8_t*)this); };
+		const int32_t V = offsetOf(registers);
+		const int32_t VF = V + 0xF;
+		const int32_t INDEX = offsetOf(&index);
+		const int32_t PC = offsetOf(&pc);
+		const int32_t STACK = offsetOf(stack);
+		const int32_t SP = offsetOf(&sp);
+		const int32_t KEYPAD = offsetOf(keypad);
+		const int32_t OPCODE = offsetOf(&opcode);
+
+		X64Emitter e;
+		e.Prologue(INDEX);
+
+		unsigned int length = 0;
+		uint16_t address = start;
+		uint16_t lastInstruction = 0;
+		bool pcWritten = false;
+
+		// Skips: pc = condition ? next + 2 : next
+		auto skip = [&e, PC](uint16_t next, uint8_t condition) {
+			e.MovEcxImm32(next + 2u);
+			e.MovEdxImm32(next);
+			e.CmovEdxEcx(condition);
+			e.MovMem16Dx(PC);
+		};
+
+		while (address + 1u < sizeof(memory) && length < MAX_BLOCK_LENGTH && !pcWritten) {
+			uint16_t instruction = (memory[address] << 8u) + memory[address + 1];
+			uint8_t x = (instruction & 0x0F00u) >> 8u;
+			uint8_t y = (instruction & 0x00F0u) >> 4u;
+			uint8_t kk = instruction & 0x00FFu;
+			uint16_t nnn = instruction & 0x0FFFu;
+			uint16_t next = address + 2;
+			bool translated = true;
+
+			switch (Decode(instruction)) {
+			case OPID_6xkk: e.MovMemImm8(V + x, kk); break;
+			case OPID_7xkk: e.AddMemImm8(V + x, kk); break;
+			case OPID_8xy0: e.MovAlMem(V + y); e.MovMemAl(V + x); break;
+			case OPID_8xy1: e.MovAlMem(V + x); e.AluAlMem(X64Emitter::OR, V + y); e.MovMemAl(V + x); break;
+			case OPID_8xy2: e.MovAlMem(V + x); e.AluAlMem(X64Emitter::AND, V + y); e.MovMemAl(V + x); break;
+			case OPID_8xy3: e.MovAlMem(V + x); e.AluAlMem(X64Emitter::XOR, V + y); e.MovMemAl(V + x); break;
+			case OPID_8xy4: // Both operands are read before VF is written, any x/y works
+				e.MovAlMem(V + x);
+				e.AluAlMem(X64Emitter::ADD, V + y);
+				e.SetccDl(X64Emitter::BELOW);
+				e.MovMemDl(VF);
+				e.MovMemAl(V + x);
+				break;
+			case OPID_8xy5:
+			case OPID_8xy7: // Same as 8xy5 in the interpreter. The operands are read again after VF is written, so VF operands stay interpreted.
+				if (x == 0xF || y == 0xF) { translated = false; break; }
+				e.MovAlMem(V + x);
+				e.AluAlMem(X64Emitter::CMP, V + y);
+				e.SetccDl(X64Emitter::ABOVE);
+				e.MovMemDl(VF);
+				e.AluAlMem(X64Emitter::SUB, V + y);
+				e.MovMemAl(V + x);
+				break;
+			case OPID_8xy6:
+			case OPID_8xyE:
+				if (x == 0xF) { translated = false; break; }
+				e.MovAlMem(V + x);
+				e.MovDlAl();
+				e.AndDlImm8(1);
+				e.MovMemDl(VF);
+				if (Decode(instruction) == OPID_8xy6) e.ShrAl();
+				else e.ShlAl();
+				e.MovMemAl(V + x);
+				break;
+			case OPID_Annn: e.MovR8dImm32(nnn); break;
+			case OPID_Fx1E: e.MovzxEaxMem8(V + x); e.AddR8dEax(); break;
+			case OPID_Fx29: e.MovzxR8dMem8(V + x); e.LeaR8dR8Times5(); e.AddR8dImm8(FONTSET_START_ADDRESS); break;
+			case OPID_1nnn: e.MovMem16Imm16(PC, nnn); pcWritten = true; break;
+			case OPID_2nnn:
+				e.MovzxEaxMem8(SP);
+				e.MovMem16IndexedImm16(STACK, next);
+				e.IncMem8(SP);
+				e.MovMem16Imm16(PC, nnn);
+				pcWritten = true;
+				break;
+			case OPID_00EE:
+				e.DecMem8(SP);
+				e.MovzxEaxMem8(SP);
+				e.MovzxEdxMem16Indexed(STACK);
+				e.MovMem16Dx(PC);
+				pcWritten = true;
+				break;
+			case OPID_Bnnn: e.MovzxEaxMem8(V); e.AddEaxImm32(nnn); e.MovMem16Ax(PC); pcWritten = true; break;
+			case OPID_3xkk: e.CmpMemImm8(V + x, kk); skip(next, X64Emitter::EQUAL); pcWritten = true; break;
+			case OPID_4xkk: e.CmpMemImm8(V + x, kk); skip(next, X64Emitter::NOT_EQUAL); pcWritten = true; break;
+			case OPID_5xy0: e.MovAlMem(V + x); e.AluAlMem(X64Emitter::CMP, V + y); skip(next, X64Emitter::EQUAL); pcWritten = true; break;
+			case OPID_9xy0: e.MovAlMem(V + x); e.AluAlMem(X64Emitter::CMP, V + y); skip(next, X64Emitter::NOT_EQUAL); pcWritten = true; break;
+			case OPID_Ex9E: e.MovzxEaxMem8(V + x); e.CmpMem8IndexedImm8(KEYPAD, 0); skip(next, X64Emitter::NOT_EQUAL); pcWritten = true; break;
+			case OPID_ExA1: e.MovzxEaxMem8(V + x); e.CmpMem8IndexedImm8(KEYPAD, 0); skip(next, X64Emitter::EQUAL); pcWritten = true; break;
+			default: translated = false; break;
+			}
+
+			if (!translated) break;
+			lastInstruction = instruction;
+			address = next;
+			length++;
+		}
+
+		if (length == 0) return JitBlock{ nullptr, 0, true }; // Interpret the first instruction
+
+		if (!pcWritten) e.MovMem16Imm16(PC, address);
+		e.MovMem16Imm16(OPCODE, (uint16_t)lastInstruction);
+		e.Epilogue(INDEX);
+
+		void* code = cache.arena.Add(e.code);
+		if (code == nullptr) { // Arena full, start over
+			cache.Clear();
+			code = cache.arena.Add(e.code);
+			if (code == nullptr) return JitBlock{ nullptr, 0, true };
+		}
+
+		for (unsigned int i = start; i < start + length * 2u && i < cache.covered.size(); i++) {
+			cache.covered[i] = true;
+		}
+		return JitBlock{ (JitFunction)code, (uint8_t)length, true };
+	}
+
+	// Calls translated blocks while they fit in the remaining cycles, interprets everything else
+	uint64_t runJit(uint64_t cycles) {
+#if CHIP8_JIT_AVAILABLE
+		JitCache& cache = jitCache.Get();
+
+		while (cycles > 0) {
+			if ((pc & 0xF001u) == 0) {
+				if (!cache.blockAt[pc >> 1u].known) {
+					JitBlock block = compileJitBlock(cache, pc);
+					cache.blockAt[pc >> 1u] = block;
+				}
+
+				const JitBlock& block = cache.blockAt[pc >> 1u];
+				if (block.function != nullptr && block.length <= cycles) {
+					cycles -= block.length;
+					block.function(this);
+					continue;
+				}
+			}
+
+			// Untranslatable instruction, odd pc or not enough cycles left for the block
+			execute(fetchPredecoded());
+			cycles--;
+			if (waitingForKey) return cycles;
+		}
+		return 0;
+#else
+		return runBlocks(cycles);
+#endif
+	}
+
+	// Threaded code: every handler jumps straight to the next one through a label table (GCC/Clang computed goto)
+	template <bool Predecoded>
+	uint64_t runThreaded(uint64_t cycles) {
+#if defined(__GNUC__)
+		static void* const labels[OPID_COUNT] = {
+#define CHIP8_LABEL_ADDRESS(name) &&L_##name,
+			CHIP8_OPCODES(CHIP8_LABEL_ADDRESS)
+#undef CHIP8_LABEL_ADDRESS
+		};
+
+		if (cycles == 0) return 0;
+
+#define CHIP8_DISPATCH() goto *labels[Predecoded ? fetchPredecoded() : fetch()]
+
+		CHIP8_DISPATCH();
+#define CHIP8_LABEL(name) \
+	L_##name: \
+		OP_##name(); \
+		if (--cycles == 0 || OPID_##name == OPID_Fx0A) return cycles; \
+		CHIP8_DISPATCH();
+		CHIP8_OPCODES(CHIP8_LABEL)
+#undef CHIP8_LABEL
+#undef CHIP8_DISPATCH
+#else
+		return runSwitch(cycles); // No computed goto (MSVC), the switch core is the closest thing
+#endif
+	}
+
+	void loadFonts() { // Loads the font set in the chip's memory
+		unsigned int pos = FONTSET_START_ADDRESS; // Font set start address
+		for (unsigned int i = 0; i < FONTSET_SIZE; i++) {
+			memory[pos + i] = fontset[i];
+		}
+	}
+};
+
+// Filled in the order of CHIP8_OPCODES so HANDLERS[OPID_x] is &Chip8::OP_x
+inline constexpr Chip8::Handler Chip8::HANDLERS[OPID_COUNT] = {
+#define CHIP8_HANDLER(name) &Chip8::OP_##name,
+	CHIP8_OPCODES(CHIP8_HANDLER)
+#undef CHIP8_HANDLER
+};
+
+inline Chip8::Chip8() : Chip8(((uint64_t)std::random_device{}() << 32u) | std::random_device{}()) {
+	// Seeded once from the OS, --seed or Chip8(seed) make runs reproducible
+}
+
+inline Chip8::Chip8(uint64_t seed) { // Constructor of the Chip
+	// Initialize PC 
+	pc = 0x200;
+	// Load the fonts into memory
+	loadFonts();
+	// Seed RND
+	Seed(seed);
+}
+
+// Reads a ROM file into memory at START_ADDRESS, returns its size or -1 (with a message on stderr) on failure
+long tryLoadROM(const char* filename, Chip8& chip8);
+
+// Copies a ROM image already in memory to START_ADDRESS, false if it does not fit
+bool loadROMData(Chip8& chip8, const uint8_t* data, size_t size);
+
+// Function that loads ROM content into memory, exits on failure
+void loadROM(const char* filename, Chip8& chip8);
+
+// FNV-1a over the machine state, to check that every core ends up in the same place
+uint64_t hashState(const Chip8& chip8);
+
+// FNV-1a over the framebuffer alone
+uint64_t hashScreen(const Chip8& chip8);
+
+// FNV-1a over memory from START_ADDRESS up, identifies the ROM when taken right after loading it
+uint64_t hashProgram(const Chip8& chip8);
+
+// Whether two machines are in the same architectural state (caches and host-side fields aside)
+bool sameState(const Chip8& a, const Chip8& b);
+
+// Prints the handlers by execution count, with the estimated ticks per execution (TSC ticks on x86,
+// nanoseconds elsewhere, timer overhead taken off) and share of the time
+void printOpcodeProfile(const OpcodeProfile& profile, std::ostream& out);
+
+// Command line names of the backends ("table", "switch", ...)
+const char* backendName(Backend backend);
+bool parseBackend(const std::string& name, Backend& backend);
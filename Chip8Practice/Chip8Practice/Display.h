@@ -0,0 +1,98 @@
+/*
+Chip-8 Emulator -- display helpers
+Turns the packed 1-bit framebuffer of the core into RGBA8888 pixels, only when a frame is
+presented. The kernel is SIMD (AVX2 or SSE2, whichever the build targets, scalar otherwise)
+and can scale by an integer factor on the way, straight into a locked streaming texture.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include "Chip8.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CHIP8_EXPAND_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CHIP8_EXPAND_SSE2 1
+#endif
+
+constexpr uint32_t PIXEL_ON = 0xFFFFFFFF;	// Default RGBA8888 color of lit pixels
+constexpr uint32_t PIXEL_OFF = 0x00000000;	// And of the others
+
+// Two-color palette used to expand the framebuffer
+struct Palette {
+	uint32_t on = PIXEL_ON;
+	uint32_t off = PIXEL_OFF;
+};
+
+// Expands one 64-pixel row, one pixel at a time
+inline void expandRowScalar(uint64_t row, uint32_t* pixels, const Palette& palette) {
+	for (unsigned int x = 0; x < SCREEN_WIDTH; x++) {
+		pixels[x] = (row >> (63u - x)) & 1u ? palette.on : palette.off;
+	}
+}
+
+// Expands one 64-pixel row with the widest vectors available: each lane tests its own bit of a
+// broadcast byte (or nibble) and picks the on or off color through the resulting mask
+inline void expandRow(uint64_t row, uint32_t* pixels, const Palette& palette) {
+#if defined(CHIP8_EXPAND_AVX2)
+	const __m256i select = _mm256_setr_epi32(0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+	const __m256i on = _mm256_set1_epi32((int)palette.on);
+	const __m256i off = _mm256_set1_epi32((int)palette.off);
+	for (unsigned int byte = 0; byte < 8; byte++) {
+		__m256i bits = _mm256_set1_epi32((int)((row >> (56u - byte * 8u)) & 0xFFu));
+		__m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(bits, select), select);
+		_mm256_storeu_si256((__m256i*)(pixels + byte * 8u), _mm256_blendv_epi8(off, on, mask));
+	}
+#elif defined(CHIP8_EXPAND_SSE2)
+	const __m128i select = _mm_setr_epi32(0x8, 0x4, 0x2, 0x1);
+	const __m128i on = _mm_set1_epi32((int)palette.on);
+	const __m128i off = _mm_set1_epi32((int)palette.off);
+	for (unsigned int nibble = 0; nibble < 16; nibble++) {
+		__m128i bits = _mm_set1_epi32((int)((row >> (60u - nibble * 4u)) & 0xFu));
+		__m128i mask = _mm_cmpeq_epi32(_mm_and_si128(bits, select), select);
+		__m128i color = _mm_or_si128(_mm_and_si128(mask, on), _mm_andnot_si128(mask, off));
+		_mm_storeu_si128((__m128i*)(pixels + nibble * 4u), color);
+	}
+#else
+	expandRowScalar(row, pixels, palette);
+#endif
+}
+
+// Expands rows [firstRow, lastRow) of the screen into a pixel buffer whose rows are pitch pixels
+// apart and which starts at firstRow, every screen pixel becoming a scale x scale square (nearest neighbor)
+template <void (*ExpandRow)(uint64_t, uint32_t*, const Palette&) = expandRow>
+void expandScreen(const uint64_t* rows, uint32_t* pixels, size_t pitch, unsigned int scale, const Palette& palette,
+	unsigned int firstRow = 0, unsigned int lastRow = SCREEN_HEIGHT) {
+	alignas(32) uint32_t line[SCREEN_WIDTH];
+
+	for (unsigned int y = firstRow; y < lastRow; y++) {
+		uint32_t* destination = pixels + (size_t)(y - firstRow) * scale * pitch;
+		if (scale == 1) {
+			ExpandRow(rows[y], destination, palette);
+			continue;
+		}
+
+		ExpandRow(rows[y], line, palette);
+		for (unsigned int x = 0; x < SCREEN_WIDTH; x++) {
+			std::fill_n(destination + (size_t)x * scale, scale, line[x]);
+		}
+		for (unsigned int copy = 1; copy < scale; copy++) {
+			std::memcpy(destination + copy * pitch, destination, (size_t)SCREEN_WIDTH * scale * sizeof(uint32_t));
+		}
+	}
+}
+
+// The smallest [firstRow, lastRow) range holding every row set in a dirty mask, empty for 0
+inline void dirtyRange(uint32_t dirtyRows, unsigned int& firstRow, unsigned int& lastRow) {
+	firstRow = 0;
+	lastRow = 0;
+	if (dirtyRows == 0) return;
+	while ((dirtyRows & (1u << firstRow)) == 0) firstRow++;
+	lastRow = SCREEN_HEIGHT;
+	while ((dirtyRows & (1u << (lastRow - 1))) == 0) lastRow--;
+}
@@ -0,0 +1,149 @@
+/*
+Chip-8 Emulator -- frame pacing
+Waits for fixed-period frame deadlines without pinning a core: the thread sleeps until
+shortly before the deadline (a high-resolution waitable timer on Windows, nanosleep
+elsewhere) and spins only for the last fraction of a millisecond. The spin margin follows
+how late the OS actually wakes us up, and every frame is recorded for jitter statistics.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+#endif
+
+// Frame-time statistics, all durations in microseconds
+struct PacingStats {
+	uint64_t frames{};
+	double meanInterval{};		// Between two frame starts
+	double intervalJitter{};	// Standard deviation of the interval
+	double maxLateness{};		// Worst frame start after its deadline
+	double sleepShare{};		// Fraction of the waiting time spent asleep rather than spinning
+	uint64_t resyncs{};			// Times the schedule was reset after falling behind
+};
+
+class FramePacer {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	explicit FramePacer(std::chrono::nanoseconds period) : period(period) {
+#if defined(_WIN32)
+		timer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+		if (timer == nullptr) timer = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS); // Before Windows 10 1803
+#endif
+		deadline = Clock::now();
+	}
+
+	~FramePacer() {
+#if defined(_WIN32)
+		if (timer != nullptr) CloseHandle(timer);
+#endif
+	}
+
+	FramePacer(const FramePacer&) = delete;
+	FramePacer& operator=(const FramePacer&) = delete;
+
+	// Blocks until the next frame is due, then schedules the one after it
+	void WaitForNextFrame() {
+		Clock::time_point waitStart = Clock::now();
+		Clock::time_point wakeTarget = deadline - spinMargin;
+		if (waitStart < wakeTarget) {
+			sleepFor(wakeTarget - waitStart);
+			Clock::time_point woke = Clock::now();
+			sleptTime += woke - waitStart;
+			adaptMargin(woke - wakeTarget);
+		}
+
+		Clock::time_point spinStart = Clock::now();
+		while (Clock::now() < deadline) {
+			std::this_thread::yield();
+		}
+		Clock::time_point frameStart = Clock::now();
+		spunTime += std::max(frameStart - spinStart, Clock::duration::zero());
+
+		record(frameStart);
+		deadline += period;
+		if (frameStart - deadline > 4 * period) { // Fell far behind (debugger, window drag), do not catch up in a burst
+			deadline = frameStart + period;
+			resyncs++;
+		}
+	}
+
+	PacingStats Stats() const {
+		PacingStats stats;
+		stats.frames = frames;
+		if (intervals > 0) {
+			stats.meanInterval = intervalSum / intervals;
+			stats.intervalJitter = std::sqrt(std::max(0.0, intervalSquareSum / intervals - stats.meanInterval * stats.meanInterval));
+		}
+		stats.maxLateness = maxLateness;
+		double waited = std::chrono::duration<double>(sleptTime + spunTime).count();
+		stats.sleepShare = waited > 0 ? std::chrono::duration<double>(sleptTime).count() / waited : 0;
+		stats.resyncs = resyncs;
+		return stats;
+	}
+private:
+	static constexpr std::chrono::microseconds MIN_SPIN_MARGIN{ 200 };
+	static constexpr std::chrono::microseconds MAX_SPIN_MARGIN{ 4000 };
+
+	std::chrono::nanoseconds period;
+	Clock::time_point deadline;
+	std::chrono::nanoseconds spinMargin{ std::chrono::microseconds(1000) };
+#if defined(_WIN32)
+	HANDLE timer{};
+#endif
+
+	uint64_t frames{};
+	uint64_t intervals{};
+	Clock::time_point lastFrameStart{};
+	double intervalSum{};
+	double intervalSquareSum{};
+	double maxLateness{};
+	Clock::duration sleptTime{};
+	Clock::duration spunTime{};
+	uint64_t resyncs{};
+
+	void sleepFor(Clock::duration duration) {
+#if defined(_WIN32)
+		if (timer != nullptr) {
+			LARGE_INTEGER dueTime;
+			dueTime.QuadPart = -(LONGLONG)(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count() / 100); // Relative, 100 ns units
+			if (SetWaitableTimerEx(timer, &dueTime, 0, nullptr, nullptr, nullptr, 0)) {
+				WaitForSingleObject(timer, INFINITE);
+				return;
+			}
+		}
+#endif
+		std::this_thread::sleep_for(duration); // nanosleep on POSIX
+	}
+
+	// Keeps the margin a bit above the recent oversleep: large enough to never wake late, small enough not to burn the core
+	void adaptMargin(Clock::duration oversleep) {
+		auto observed = std::chrono::duration_cast<std::chrono::nanoseconds>(oversleep) * 3 / 2;
+		auto next = observed > spinMargin ? observed : spinMargin - (spinMargin - observed) / 16; // Grow at once, shrink slowly
+		spinMargin = std::clamp<std::chrono::nanoseconds>(next, MIN_SPIN_MARGIN, MAX_SPIN_MARGIN);
+	}
+
+	void record(Clock::time_point frameStart) {
+		if (frames > 0) {
+			double interval = std::chrono::duration<double, std::micro>(frameStart - lastFrameStart).count();
+			intervalSum += interval;
+			intervalSquareSum += interval * interval;
+			intervals++;
+		}
+		maxLateness = std::max(maxLateness, std::chrono::duration<double, std::micro>(frameStart - deadline).count());
+		lastFrameStart = frameStart;
+		frames++;
+	}
+};
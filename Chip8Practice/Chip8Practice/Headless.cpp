@@ -0,0 +1,225 @@
+/*
+Chip-8 Emulator -- headless runner
+Runs a ROM without a window or SDL for a number of frames or instructions, feeding it an
+optional input script (see HeadlessRun.h), then prints the final machine state and the
+state and framebuffer hashes, one "name value" pair per line. Runs can start from and end
+in a save state file (Chip8::SaveState), and movies recorded by the frontend (Movie.h)
+replay here unthrottled, from their start or from any frame (--seek). --profile-opcodes
+adds a histogram of the handlers run (Chip8::opcodeProfile), --profile-pc the hottest blocks
+and subroutines, with the call stacks written out for flame graphs (PcProfile.h).
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "Chip8.h"
+#include "HeadlessRun.h"
+#include "Movie.h"
+
+namespace {
+
+void printUsage(const char* program) {
+	std::cerr << "Usage: " << program << " (<ROM> | --load-state <file>) (--frames <n> | --cycles <n>) [--ipf <n>] [--input <script>]"
+		<< " [--backend table|switch|threaded|predecoded|blocks|jit] [--seed <n>] [--save-state <file>] [--screen] [--profile-opcodes] [--profile-pc <stacks>]\n"
+		<< "       " << program << " [ROM] --replay <movie> [--seek <frame>] [--frames <n> | --cycles <n>] [--backend <name>] [--save-state <file>] [--screen] [--profile-opcodes] [--profile-pc <stacks>]\n";
+}
+
+bool loadStateFile(const char* filename, Chip8& chip8) {
+	std::ifstream in(filename, std::ios::binary);
+	if (!in) {
+		std::cerr << "Cannot open save state " << filename << std::endl;
+		return false;
+	}
+	std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	if (!chip8.LoadState(data.data(), data.size())) {
+		std::cerr << "Bad save state " << filename << " (corrupt, or not version " << SAVE_STATE_VERSION << ")" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool saveStateFile(const char* filename, const Chip8& chip8) {
+	std::vector<uint8_t> data = chip8.SaveState();
+	std::ofstream out(filename, std::ios::binary);
+	out.write(reinterpret_cast<const char*>(data.data()), (std::streamsize)data.size());
+	if (!out) {
+		std::cerr << "Cannot write save state " << filename << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void printScreen(const Chip8& chip8) {
+	for (unsigned int y = 0; y < SCREEN_HEIGHT; y++) {
+		std::string row(SCREEN_WIDTH, '.');
+		for (unsigned int x = 0; x < SCREEN_WIDTH; x++) {
+			if ((chip8.screen[y] >> (63u - x)) & 1u) row[x] = '#';
+		}
+		std::cout << row << "\n";
+	}
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+	const char* romFilename = nullptr;
+	const char* inputFilename = nullptr;
+	const char* movieFilename = nullptr;
+	uint64_t seekFrame = 0;
+	const char* loadStateFilename = nullptr;
+	const char* saveStateFilename = nullptr;
+	RunLimits limits;
+	Backend backend = Backend::Predecoded;
+	uint64_t seed = 1;
+	bool showScreen = false;
+	bool profileOpcodes = false;
+	const char* profilePcFilename = nullptr;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--frames" && i + 1 < argc) {
+			limits.frames = std::stoull(argv[++i]);
+		}
+		else if (arg == "--cycles" && i + 1 < argc) {
+			limits.cycles = std::stoull(argv[++i]);
+		}
+		else if (arg == "--ipf" && i + 1 < argc) {
+			limits.instructionsPerFrame = std::max(1, std::stoi(argv[++i]));
+		}
+		else if (arg == "--input" && i + 1 < argc) {
+			inputFilename = argv[++i];
+		}
+		else if (arg == "--replay" && i + 1 < argc) {
+			movieFilename = argv[++i];
+		}
+		else if (arg == "--seek" && i + 1 < argc) {
+			seekFrame = std::stoull(argv[++i]);
+		}
+		else if (arg == "--backend" && i + 1 < argc) {
+			if (!parseBackend(argv[++i], backend)) {
+				std::cerr << "Unknown backend: " << argv[i] << std::endl;
+				return -1;
+			}
+		}
+		else if (arg == "--seed" && i + 1 < argc) {
+			seed = std::stoull(argv[++i]);
+		}
+		else if (arg == "--load-state" && i + 1 < argc) {
+			loadStateFilename = argv[++i];
+		}
+		else if (arg == "--save-state" && i + 1 < argc) {
+			saveStateFilename = argv[++i];
+		}
+		else if (arg == "--screen") {
+			showScreen = true;
+		}
+		else if (arg == "--profile-opcodes") {
+			profileOpcodes = true;
+		}
+		else if (arg == "--profile-pc" && i + 1 < argc) {
+			profilePcFilename = argv[++i];
+		}
+		else if (romFilename == nullptr && arg.rfind("--", 0) != 0) {
+			romFilename = argv[i];
+		}
+		else {
+			printUsage(argv[0]);
+			return -1;
+		}
+	}
+
+	// A movie brings its own seed, speed, input, length (unless --frames or --cycles cut it short)
+	// and starting state (its first keyframe, so the ROM is optional)
+	MovieReader movie;
+	std::string error;
+	if (movieFilename != nullptr) {
+		if (inputFilename != nullptr || !movie.Open(movieFilename, error)) {
+			std::cerr << "Bad movie " << movieFilename << ": " << (inputFilename != nullptr ? "--input given too" : error) << std::endl;
+			return -1;
+		}
+		seed = movie.Header().seed;
+		limits.instructionsPerFrame = movie.Header().instructionsPerFrame;
+		if (limits.frames == 0 && limits.cycles == 0 && seekFrame < movie.Header().frames) limits.frames = movie.Header().frames - seekFrame;
+	}
+
+	if ((romFilename == nullptr && loadStateFilename == nullptr && movieFilename == nullptr) || (limits.frames == 0 && limits.cycles == 0)) {
+		printUsage(argv[0]);
+		return -1;
+	}
+
+	std::vector<InputEvent> events;
+	if (inputFilename != nullptr && !loadInputScript(inputFilename, events, error)) {
+		std::cerr << "Bad input script " << inputFilename << ": " << error << std::endl;
+		return -1;
+	}
+	if (movieFilename != nullptr) movie.Events(events);
+
+	Chip8* chip8 = new Chip8(seed);
+	chip8->backend = backend;
+	bool loaded = romFilename == nullptr || tryLoadROM(romFilename, *chip8) >= 0;
+	if (loaded && movieFilename != nullptr && romFilename != nullptr && hashProgram(*chip8) != movie.Header().romHash) {
+		std::cerr << "The movie was recorded with another ROM" << std::endl;
+		loaded = false;
+	}
+	if (loaded && movieFilename != nullptr && !movie.Seek(*chip8, seekFrame)) {
+		std::cerr << "The movie has " << movie.Header().frames << " frames, cannot start at " << seekFrame << std::endl;
+		loaded = false;
+	}
+	if (!loaded || (loadStateFilename != nullptr && !loadStateFile(loadStateFilename, *chip8))) {
+		delete chip8;
+		return -1;
+	}
+
+	OpcodeProfile profile;
+	PcProfile pcProfile;
+	if (profileOpcodes) chip8->opcodeProfile = &profile; // From here on, the seek is not profiled
+	if (profilePcFilename != nullptr) chip8->pcProfile = &pcProfile;
+
+	// Input from the seek point on
+	uint64_t frame = movieFilename != nullptr ? seekFrame : 0;
+	size_t nextEvent = std::lower_bound(events.begin(), events.end(), frame,
+		[](const InputEvent& event, uint64_t frame) { return event.frame < frame; }) - events.begin();
+	RunResult result = runScripted(*chip8, events, limits, frame, nextEvent);
+	if (saveStateFilename != nullptr && !saveStateFile(saveStateFilename, *chip8)) {
+		delete chip8;
+		return -1;
+	}
+
+	std::cout << "frames " << result.frames << "\n"
+		<< "cycles " << result.cycles << "\n"
+		<< "skipped_frames " << result.skippedFrames << "\n"
+		<< "blocked_on_input " << result.blockedOnInput << "\n"
+		<< std::hex << std::setfill('0')
+		<< "pc " << std::setw(3) << chip8->pc << "\n"
+		<< "index " << std::setw(3) << chip8->index << "\n"
+		<< "v";
+	for (uint8_t value : chip8->registers) std::cout << " " << std::setw(2) << (unsigned int)value;
+	std::cout << "\n"
+		<< "sp " << (unsigned int)chip8->sp << "\n"
+		<< "delay_timer " << std::setw(2) << (unsigned int)chip8->delay_timer << "\n"
+		<< "sound_timer " << std::setw(2) << (unsigned int)chip8->sound_timer << "\n"
+		<< "state_hash " << std::setw(16) << hashState(*chip8) << "\n"
+		<< "screen_hash " << std::setw(16) << hashScreen(*chip8) << "\n"
+		<< std::dec;
+	if (movieFilename != nullptr && movie.Complete() && frame == movie.Header().frames) {
+		std::cout << "replay_match " << (hashState(*chip8) == movie.Header().finalStateHash) << "\n";
+	}
+	if (showScreen) printScreen(*chip8);
+	if (profileOpcodes) printOpcodeProfile(profile, std::cout);
+	if (profilePcFilename != nullptr) {
+		pcProfile.PrintFlat(std::cout, chip8->memory);
+		std::ofstream stacks(profilePcFilename);
+		pcProfile.WriteCollapsed(stacks);
+		if (!stacks) {
+			std::cerr << "Cannot write call stacks " << profilePcFilename << std::endl;
+			delete chip8;
+			return -1;
+		}
+	}
+
+	delete chip8;
+	return 0;
+}
@@ -0,0 +1,136 @@
+/*
+Chip-8 Emulator -- render-less runs
+Input scripts and the frame loop used by the headless runner (and anything else that runs
+a ROM without a window): fixed frames of instructions, one timer tick per frame, keypad
+events delivered at the frame they are scripted for.
+
+Input script format, one event per line, '#' starts a comment:
+	<frame> <key> <down|up>
+for example "120 5 down" presses key 5 at the start of frame 120. Keys are hexadecimal (0-F).
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include "Chip8.h"
+
+struct InputEvent {
+	uint64_t frame;		// Delivered before the instructions of this frame run
+	uint8_t key;
+	bool pressed;
+};
+
+// Parses an input script, events end up sorted by frame (in file order within a frame)
+inline bool parseInputScript(std::istream& in, std::vector<InputEvent>& events, std::string& error) {
+	std::string line;
+	for (unsigned int lineNumber = 1; std::getline(in, line); lineNumber++) {
+		line = line.substr(0, line.find('#'));
+		std::istringstream fields(line);
+		std::string frame, key, action;
+		if (!(fields >> frame)) continue; // Blank or comment
+
+		InputEvent event{};
+		try {
+			fields >> key >> action;
+			event.frame = std::stoull(frame);
+			unsigned long keyValue = std::stoul(key, nullptr, 16);
+			if (keyValue > 0xF || (action != "down" && action != "up")) throw std::invalid_argument(line);
+			event.key = (uint8_t)keyValue;
+			event.pressed = action == "down";
+		}
+		catch (const std::exception&) {
+			error = "line " + std::to_string(lineNumber) + ": expected <frame> <key 0-F> <down|up>";
+			return false;
+		}
+		events.push_back(event);
+	}
+
+	std::stable_sort(events.begin(), events.end(), [](const InputEvent& a, const InputEvent& b) { return a.frame < b.frame; });
+	return true;
+}
+
+inline bool loadInputScript(const char* filename, std::vector<InputEvent>& events, std::string& error) {
+	std::ifstream in(filename);
+	if (!in) {
+		error = "cannot open " + std::string(filename);
+		return false;
+	}
+	return parseInputScript(in, events, error);
+}
+
+// When a run stops, whichever limit is non-zero comes first
+struct RunLimits {
+	uint64_t frames = 0;
+	uint64_t cycles = 0;
+	unsigned int instructionsPerFrame = DEFAULT_INSTRUCTIONS_PER_FRAME;
+};
+
+struct RunResult {
+	uint64_t frames = 0;		// Frames elapsed, skipped ones included
+	uint64_t cycles = 0;		// Instructions executed
+	uint64_t skippedFrames = 0;	// Frames fast-forwarded while blocked on Fx0A or in an idle loop
+	bool blockedOnInput = false;	// Stopped on Fx0A with no scripted input left
+};
+
+// Runs frames until a limit is reached. While the CPU waits on Fx0A, or spins in a loop that only
+// polls the keypad (Chip8::IdleAcrossFrames), nothing but the timers can change, so the frames up
+// to the next scripted event are skipped at once instead of stepped.
+// Runs can be resumed: frame is the number of the next frame to run and nextEvent the first
+// event not delivered yet, both updated on return.
+inline RunResult runScripted(Chip8& chip8, const std::vector<InputEvent>& events, const RunLimits& limits,
+	uint64_t& frame, size_t& nextEvent) {
+	RunResult result;
+	const uint64_t noLimit = ~(uint64_t)0;
+	uint64_t lastFrame = limits.frames != 0 ? frame + limits.frames : noLimit;
+	uint64_t maxCycles = limits.cycles != 0 ? limits.cycles : noLimit;
+	if (lastFrame == noLimit && maxCycles == noLimit) return result;
+
+	while (frame < lastFrame && result.cycles < maxCycles) {
+		for (; nextEvent < events.size() && events[nextEvent].frame <= frame; nextEvent++) {
+			chip8.KeyEvent(events[nextEvent].key, events[nextEvent].pressed);
+		}
+
+		if (chip8.waitingForKey) {
+			if (nextEvent == events.size() && lastFrame == noLimit) { // Nothing will ever wake it up
+				result.blockedOnInput = true;
+				break;
+			}
+			uint64_t wake = std::min(nextEvent < events.size() ? events[nextEvent].frame : noLimit, lastFrame);
+			uint64_t skipped = wake - frame;
+			for (uint64_t tick = 0; tick < std::min<uint64_t>(skipped, 255); tick++) chip8.TickTimers();
+			frame = wake;
+			result.frames += skipped;
+			result.skippedFrames += skipped;
+			if (nextEvent == events.size()) result.blockedOnInput = true;
+			continue;
+		}
+
+		result.cycles += chip8.Run(std::min<uint64_t>(limits.instructionsPerFrame, maxCycles - result.cycles));
+		chip8.TickTimers();
+		frame++;
+		result.frames++;
+
+		if (chip8.IdleAcrossFrames()) {
+			uint64_t wake = std::min(nextEvent < events.size() ? events[nextEvent].frame : noLimit, lastFrame);
+			uint64_t skipped = std::min(wake - frame, (maxCycles - result.cycles) / limits.instructionsPerFrame);
+			chip8.SkipIdleFrames(skipped, limits.instructionsPerFrame);
+			frame += skipped;
+			result.frames += skipped;
+			result.cycles += skipped * limits.instructionsPerFrame;
+			result.skippedFrames += skipped;
+		}
+	}
+	return result;
+}
+
+inline RunResult runScripted(Chip8& chip8, const std::vector<InputEvent>& events, const RunLimits& limits) {
+	uint64_t frame = 0;
+	size_t nextEvent = 0;
+	return runScripted(chip8, events, limits, frame, nextEvent);
+}
@@ -0,0 +1,219 @@
+/*
+x86-64 code generation for the Chip-8 JIT backend (Backend::Jit in main.cpp):
+an executable arena that is never writable and executable at the same time, a tiny
+assembler for the handful of instructions the translator needs, and the block cache.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <bitset>
+#include <algorithm>
+#include <initializer_list>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CHIP8_JIT_AVAILABLE 1
+#else
+#define CHIP8_JIT_AVAILABLE 0
+#endif
+
+#if CHIP8_JIT_AVAILABLE
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+// Fixed-size region holding generated code. It is mapped read+write only while code is being
+// copied in and read+execute otherwise (W^X).
+class ExecutableArena {
+public:
+	explicit ExecutableArena(size_t capacity) : capacity(capacity) {
+#if CHIP8_JIT_AVAILABLE
+#if defined(_WIN32)
+		base = (uint8_t*)VirtualAlloc(nullptr, capacity, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+		void* mapping = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		base = mapping != MAP_FAILED ? (uint8_t*)mapping : nullptr;
+#endif
+#endif
+	}
+
+	~ExecutableArena() {
+#if CHIP8_JIT_AVAILABLE
+		if (base == nullptr) return;
+#if defined(_WIN32)
+		VirtualFree(base, 0, MEM_RELEASE);
+#else
+		munmap(base, capacity);
+#endif
+#endif
+	}
+
+	ExecutableArena(const ExecutableArena&) = delete;
+	ExecutableArena& operator=(const ExecutableArena&) = delete;
+
+	// Copies code into the arena, returns its address or nullptr when the arena is full
+	void* Add(const std::vector<uint8_t>& code) {
+		if (base == nullptr || used + code.size() > capacity) return nullptr;
+
+		uint8_t* destination = base + used;
+		setExecutable(false);
+		std::memcpy(destination, code.data(), code.size());
+		setExecutable(true);
+#if CHIP8_JIT_AVAILABLE && defined(_WIN32)
+		FlushInstructionCache(GetCurrentProcess(), destination, code.size());
+#endif
+		used += (code.size() + 15u) & ~(size_t)15u; // Keep entry points 16-byte aligned
+		return destination;
+	}
+
+	void Reset() {
+		used = 0;
+	}
+private:
+	uint8_t* base{};
+	size_t capacity{};
+	size_t used{};
+
+	void setExecutable(bool executable) {
+#if CHIP8_JIT_AVAILABLE
+#if defined(_WIN32)
+		DWORD previous;
+		VirtualProtect(base, capacity, executable ? PAGE_EXECUTE_READ : PAGE_READWRITE, &previous);
+#else
+		mprotect(base, capacity, executable ? (PROT_READ | PROT_EXEC) : (PROT_READ | PROT_WRITE));
+#endif
+#endif
+	}
+};
+
+// Emits the x86-64 instructions used by the translator. Guest state is addressed as
+// [rbx + disp32], rbx holding the Chip8 pointer for the whole block, and the index
+// register lives in r8d. al/dl/eax/ecx/edx are scratch.
+class X64Emitter {
+public:
+	std::vector<uint8_t> code;
+
+	// ALU opcodes of the "op al, [rbx + disp32]" form
+	static constexpr uint8_t ADD = 0x02;
+	static constexpr uint8_t OR = 0x0A;
+	static constexpr uint8_t AND = 0x22;
+	static constexpr uint8_t SUB = 0x2A;
+	static constexpr uint8_t XOR = 0x32;
+	static constexpr uint8_t CMP = 0x3A;
+
+	// Condition codes for cmov/setcc
+	static constexpr uint8_t BELOW = 0x2;		// Carry set
+	static constexpr uint8_t EQUAL = 0x4;
+	static constexpr uint8_t NOT_EQUAL = 0x5;
+	static constexpr uint8_t ABOVE = 0x7;
+
+	// push rbx; mov rbx, <first argument>; movzx r8d, word [rbx + index]
+	void Prologue(int32_t index) {
+		bytes({ 0x53 });
+#if defined(_WIN32)
+		bytes({ 0x48, 0x89, 0xCB });	// mov rbx, rcx
+#else
+		bytes({ 0x48, 0x89, 0xFB });	// mov rbx, rdi
+#endif
+		bytes({ 0x44, 0x0F, 0xB7, 0x83 }); disp(index);
+	}
+
+	// mov word [rbx + index], r8w; pop rbx; ret
+	void Epilogue(int32_t index) {
+		bytes({ 0x66, 0x44, 0x89, 0x83 }); disp(index);
+		bytes({ 0x5B, 0xC3 });
+	}
+
+	void MovAlMem(int32_t d) { bytes({ 0x8A, 0x83 }); disp(d); }
+	void MovMemAl(int32_t d) { bytes({ 0x88, 0x83 }); disp(d); }
+	void MovMemDl(int32_t d) { bytes({ 0x88, 0x93 }); disp(d); }
+	void MovDlAl() { bytes({ 0x88, 0xC2 }); }
+	void AluAlMem(uint8_t op, int32_t d) { bytes({ op, 0x83 }); disp(d); }
+	void AndDlImm8(uint8_t imm) { bytes({ 0x80, 0xE2, imm }); }
+	void ShrAl() { bytes({ 0xD0, 0xE8 }); }
+	void ShlAl() { bytes({ 0xD0, 0xE0 }); }
+	void SetccDl(uint8_t condition) { bytes({ 0x0F, (uint8_t)(0x90u | condition), 0xC2 }); }
+
+	void MovMemImm8(int32_t d, uint8_t imm) { bytes({ 0xC6, 0x83 }); disp(d); bytes({ imm }); }
+	void AddMemImm8(int32_t d, uint8_t imm) { bytes({ 0x80, 0x83 }); disp(d); bytes({ imm }); }
+	void CmpMemImm8(int32_t d, uint8_t imm) { bytes({ 0x80, 0xBB }); disp(d); bytes({ imm }); }
+	void IncMem8(int32_t d) { bytes({ 0xFE, 0x83 }); disp(d); }
+	void DecMem8(int32_t d) { bytes({ 0xFE, 0x8B }); disp(d); }
+	void MovMem16Imm16(int32_t d, uint16_t imm) { bytes({ 0x66, 0xC7, 0x83 }); disp(d); imm16(imm); }
+	void MovMem16Ax(int32_t d) { bytes({ 0x66, 0x89, 0x83 }); disp(d); }
+	void MovMem16Dx(int32_t d) { bytes({ 0x66, 0x89, 0x93 }); disp(d); }
+
+	void MovzxEaxMem8(int32_t d) { bytes({ 0x0F, 0xB6, 0x83 }); disp(d); }
+	void MovzxR8dMem8(int32_t d) { bytes({ 0x44, 0x0F, 0xB6, 0x83 }); disp(d); }
+	void MovR8dImm32(uint32_t imm) { bytes({ 0x41, 0xB8 }); imm32(imm); }
+	void AddR8dEax() { bytes({ 0x41, 0x01, 0xC0 }); }
+	void AddR8dImm8(uint8_t imm) { bytes({ 0x41, 0x83, 0xC0, imm }); }
+	void LeaR8dR8Times5() { bytes({ 0x47, 0x8D, 0x04, 0x80 }); } // lea r8d, [r8 + r8*4]
+	void AddEaxImm32(uint32_t imm) { bytes({ 0x05 }); imm32(imm); }
+	void MovEcxImm32(uint32_t imm) { bytes({ 0xB9 }); imm32(imm); }
+	void MovEdxImm32(uint32_t imm) { bytes({ 0xBA }); imm32(imm); }
+	void CmovEdxEcx(uint8_t condition) { bytes({ 0x0F, (uint8_t)(0x40u | condition), 0xD1 }); }
+
+	// Indexed by rax: mov word [rbx + rax*2 + d], imm16 / movzx edx, word [rbx + rax*2 + d] / cmp byte [rbx + rax + d], imm8
+	void MovMem16IndexedImm16(int32_t d, uint16_t imm) { bytes({ 0x66, 0xC7, 0x84, 0x43 }); disp(d); imm16(imm); }
+	void MovzxEdxMem16Indexed(int32_t d) { bytes({ 0x0F, 0xB7, 0x94, 0x43 }); disp(d); }
+	void CmpMem8IndexedImm8(int32_t d, uint8_t imm) { bytes({ 0x80, 0xBC, 0x03 }); disp(d); bytes({ imm }); }
+private:
+	void bytes(std::initializer_list<uint8_t> values) {
+		code.insert(code.end(), values);
+	}
+
+	void imm16(uint16_t value) {
+		bytes({ (uint8_t)value, (uint8_t)(value >> 8u) });
+	}
+
+	void imm32(uint32_t value) {
+		bytes({ (uint8_t)value, (uint8_t)(value >> 8u), (uint8_t)(value >> 16u), (uint8_t)(value >> 24u) });
+	}
+
+	void disp(int32_t value) {
+		imm32((uint32_t)value);
+	}
+};
+
+// Native entry point of a translated block, called with the Chip8 it runs on
+using JitFunction = void (*)(void* chip8);
+
+struct JitBlock {
+	JitFunction function;	// nullptr when the first instruction has to be interpreted
+	uint8_t length;			// Instructions (and cycles) covered by the block
+	bool known;				// Whether the address was looked at yet
+};
+
+// Translated blocks keyed by start address. Like BlockCache, a write into any translated
+// address throws away every translation.
+struct JitCache {
+	static constexpr size_t ARENA_SIZE = 1u << 20u;
+
+	ExecutableArena arena{ ARENA_SIZE };
+	JitBlock blockAt[4096 / 2]{};
+	std::bitset<4096> covered;
+
+	void Clear() {
+		arena.Reset();
+		std::fill(std::begin(blockAt), std::end(blockAt), JitBlock{});
+		covered.reset();
+	}
+
+	void Invalidate(uint16_t address, unsigned int size) {
+		for (unsigned int i = address; i < address + size && i < covered.size(); i++) {
+			if (covered[i]) {
+				Clear();
+				return;
+			}
+		}
+	}
+};
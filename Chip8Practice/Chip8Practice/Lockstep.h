@@ -0,0 +1,384 @@
+/*
+Chip-8 Emulator -- lock-step engine
+Runs Lanes instances of the same ROM side by side, every piece of state stored as
+structure-of-arrays (one row of Lanes values per register, per memory byte, ...) so one
+decoded instruction updates every lane with straight loops: the ALU, skip and
+load/store-immediate instructions are written as branch-free per-lane blends for the
+compiler to auto-vectorize. There are no intrinsics here, so the vector width is whatever
+the build targets: SSE2 in a default x86-64 build, AVX2 with the CHIP8_AVX2 CMake option
+(LOCKSTEP_VECTOR_ISA names it).
+
+Each step groups the runnable lanes by (pc, opcode); the usual case is a single group. Lanes
+that keep running outside the largest group are handed over to a scalar Chip8 of their own.
+The lanes only differ by their RND seeds and their input, and every lane behaves exactly
+like a Chip8 with the same seed (RND always comes from the lane's own Pcg32Random).
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <algorithm>
+#include "Chip8.h"
+
+#if defined(__AVX512BW__)
+constexpr const char* LOCKSTEP_VECTOR_ISA = "AVX-512";
+#elif defined(__AVX2__)
+constexpr const char* LOCKSTEP_VECTOR_ISA = "AVX2";
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+constexpr const char* LOCKSTEP_VECTOR_ISA = "SSE2";
+#else
+constexpr const char* LOCKSTEP_VECTOR_ISA = "scalar";
+#endif
+
+template <unsigned int Lanes>
+class LockstepChip8 {
+public:
+	static constexpr unsigned int EJECT_AFTER = 256;	// Steps a lane may spend outside the largest group
+
+	Backend scalarBackend = Backend::Predecoded;		// Core of the lanes that were handed over
+
+	explicit LockstepChip8(const uint64_t* seeds) {
+		for (unsigned int lane = 0; lane < Lanes; lane++) {
+			pc[lane] = START_ADDRESS;
+			rng[lane].Seed(seeds[lane]);
+			dirtyRows[lane] = ~0u;
+			vectorLanes[lane] = 0xFF;
+		}
+		for (unsigned int i = 0; i < FONTSET_SIZE; i++) {
+			std::fill_n(memory[FONTSET_START_ADDRESS + i], Lanes, fontset[i]);
+		}
+	}
+
+	// Same ROM in every lane
+	bool LoadROM(const uint8_t* data, size_t size) {
+		if (size > 4096u - START_ADDRESS) return false;
+		for (size_t i = 0; i < size; i++) {
+			std::fill_n(memory[START_ADDRESS + i], Lanes, data[i]);
+		}
+		return true;
+	}
+
+	// Runs steps instructions in every lane (fewer in the lanes that stop on Fx0A)
+	void Run(uint64_t steps) {
+		for (runStep = 0; runStep < steps; runStep++) {
+			if (!stepVector()) break; // Every vector lane waits on Fx0A or was handed over
+		}
+		for (unsigned int lane = 0; lane < Lanes; lane++) {
+			if (!scalar[lane]) continue;
+			scalar[lane]->Run(steps - ejectedAfter[lane]); // Whatever the lane did not run as a vector lane
+			ejectedAfter[lane] = 0;
+		}
+	}
+
+	void TickTimers() {
+		for (unsigned int lane = 0; lane < Lanes; lane++) {
+			delayTimer[lane] -= delayTimer[lane] > 0;
+			soundTimer[lane] -= soundTimer[lane] > 0;
+			if (scalar[lane]) scalar[lane]->TickTimers();
+		}
+	}
+
+	// Same as Chip8::KeyEvent for one lane
+	void KeyEvent(unsigned int lane, uint8_t key, bool pressed) {
+		if (scalar[lane]) {
+			scalar[lane]->KeyEvent(key, pressed);
+			return;
+		}
+		keypad[key][lane] = pressed;
+		if (!waiting[lane]) return;
+
+		if (pressed) {
+			keyWaitPressed[lane] |= 1u << key;
+		}
+		else if (keyWaitPressed[lane] & (1u << key)) {
+			V[keyWaitRegister[lane]][lane] = key;
+			waiting[lane] = 0;
+		}
+	}
+
+	// Copies the state of one lane into a scalar machine
+	void Extract(unsigned int lane, Chip8& chip8) const {
+		if (scalar[lane]) {
+			chip8 = *scalar[lane];
+			return;
+		}
+		for (unsigned int i = 0; i < 16; i++) {
+			chip8.registers[i] = V[i][lane];
+			chip8.stack[i] = stack[i][lane];
+			chip8.keypad[i] = keypad[i][lane];
+		}
+		for (unsigned int address = 0; address < 4096; address++) {
+			chip8.memory[address] = memory[address][lane];
+		}
+		chip8.index = index[lane];
+		chip8.pc = pc[lane];
+		chip8.sp = sp[lane];
+		chip8.delay_timer = delayTimer[lane];
+		chip8.sound_timer = soundTimer[lane];
+		chip8.waitingForKey = waiting[lane] != 0;
+		chip8.keyWaitRegister = keyWaitRegister[lane];
+		chip8.keyWaitPressed = keyWaitPressed[lane];
+		for (unsigned int y = 0; y < SCREEN_HEIGHT; y++) {
+			chip8.screen[y] = screen[y][lane];
+		}
+		chip8.displayGeneration = displayGeneration[lane];
+		chip8.dirtyRows = dirtyRows[lane];
+		chip8.rng = rng[lane];
+		chip8.InvalidateCode(0, sizeof(chip8.memory));
+	}
+
+	unsigned int ScalarLanes() const { return handedOver; }
+
+	uint64_t Steps() const { return steps; }
+	uint64_t Groups() const { return groups; } // Groups executed, Groups() / Steps() is the average divergence
+private:
+	alignas(64) uint8_t memory[4096][Lanes]{};	// memory[address][lane]
+	alignas(64) uint8_t V[16][Lanes]{};
+	alignas(64) uint16_t pc[Lanes]{};
+	alignas(64) uint16_t index[Lanes]{};
+	alignas(64) uint16_t stack[16][Lanes]{};
+	alignas(64) uint8_t sp[Lanes]{};
+	alignas(64) uint8_t delayTimer[Lanes]{};
+	alignas(64) uint8_t soundTimer[Lanes]{};
+	alignas(64) uint8_t keypad[16][Lanes]{};
+	alignas(64) uint8_t waiting[Lanes]{};
+	uint8_t keyWaitRegister[Lanes]{};
+	uint16_t keyWaitPressed[Lanes]{};
+	alignas(64) uint64_t screen[SCREEN_HEIGHT][Lanes]{};
+	uint64_t displayGeneration[Lanes]{};
+	uint32_t dirtyRows[Lanes]{};
+	Pcg32Random rng[Lanes]{};
+
+	uint32_t divergence[Lanes]{};				// Consecutive steps outside the largest group
+	std::unique_ptr<Chip8> scalar[Lanes];		// Lanes that were handed over, their vector state is dead
+	uint64_t ejectedAfter[Lanes]{};				// Steps of the current Run() a lane did before it was handed over
+	alignas(64) uint8_t vectorLanes[Lanes]{};	// Mask of the lanes not handed over
+	unsigned int handedOver{};
+	unsigned int firstVectorLane{};
+	uint64_t runStep{};
+	uint64_t steps{};
+	uint64_t groups{};
+
+	// One instruction in every runnable lane, returns false when no vector lane can run
+	bool stepVector() {
+		if (stepConverged()) return true;
+
+		alignas(64) uint8_t pending[Lanes];
+		alignas(64) uint16_t opcodes[Lanes];
+		bool any = false;
+		for (unsigned int lane = 0; lane < Lanes; lane++) {
+			pending[lane] = vectorLanes[lane] & ~(0u - waiting[lane]);
+			any |= pending[lane] != 0;
+		}
+		if (!any) return false;
+		for (unsigned int lane = 0; lane < Lanes; lane++) {
+			uint16_t address = pc[lane] & 0xFFFu;
+			opcodes[lane] = (uint16_t)((memory[address][lane] << 8u) | memory[(address + 1u) & 0xFFFu][lane]);
+		}
+
+		alignas(64) uint8_t largest[Lanes]{};
+		unsigned int largestSize = 0;
+		unsigned int groupCount = 0;
+		for (unsigned int leader = 0; leader < Lanes; leader++) {
+			if (!pending[leader]) continue;
+
+			alignas(64) uint8_t group[Lanes];
+			unsigned int size = 0;
+			for (unsigned int lane = 0; lane < Lanes; lane++) {
+				group[lane] = (pending[lane] && pc[lane] == pc[leader] && opcodes[lane] == opcodes[leader]) ? 0xFF : 0;
+				size += group[lane] & 1u;
+			}
+			for (unsigned int lane = 0; lane < Lanes; lane++) pending[lane] &= ~group[lane];
+
+			execute(group, opcodes[leader]);
+			groupCount++;
+			if (size > largestSize) {
+				largestSize = size;
+				std::memcpy(largest, group, sizeof(group));
+			}
+		}
+		steps++;
+		groups += groupCount;
+
+		if (groupCount > 1) {
+			for (unsigned int lane = 0; lane < Lanes; lane++) {
+				if (scalar[lane] || waiting[lane]) continue;
+				divergence[lane] = largest[lane] ? 0 : divergence[lane] + 1;
+				if (divergence[lane] > EJECT_AFTER) eject(lane);
+			}
+		}
+		return true;
+	}
+
+	// The usual case: every vector lane runnable, at the same pc, on the same opcode. Returns false when it does not apply.
+	bool stepConverged() {
+		if (handedOver == Lanes) return false;
+		const unsigned int first = firstVectorLane;
+		const uint16_t address = pc[first] & 0xFFFu;
+		const uint8_t* high = memory[address];
+		const uint8_t* low = memory[(address + 1u) & 0xFFFu];
+		unsigned int differ = 0;
+		for (unsigned int lane = 0; lane < Lanes; lane++) {
+			// Each lane's difference as a bool first, the 8-bit lane mask would drop the high bits of the pc
+			differ |= (((pc[lane] ^ pc[first]) | (high[lane] ^ high[first]) | (low[lane] ^ low[first]) | waiting[lane]) != 0) & (vectorLanes[lane] != 0);
+		}
+		if (differ != 0) return false;
+
+		execute(vectorLanes, (uint16_t)((high[first] << 8u) | low[first]));
+		steps++;
+		groups++;
+		return true;
+	}
+
+	void eject(unsigned int lane) {
+		auto chip8 = std::make_unique<Chip8>(0);
+		Extract(lane, *chip8);
+		chip8->backend = scalarBackend;
+		scalar[lane] = std::move(chip8);
+		ejectedAfter[lane] = runStep + 1;
+		vectorLanes[lane] = 0;
+		handedOver++;
+		while (firstVectorLane < Lanes && !vectorLanes[firstVectorLane]) firstVectorLane++;
+	}
+
+	// dst[lane] = value(lane) in the lanes of the mask, written so that it vectorizes
+	template <typename T, typename Value>
+	static void blend(T* dst, const uint8_t* mask, Value value) {
+		for (unsigned int lane = 0; lane < Lanes; lane++) {
+			T result = (T)value(lane);
+			dst[lane] = mask[lane] ? result : dst[lane];
+		}
+	}
+
+	// Executes one opcode in the lanes of the mask, with the same semantics as the Chip8 handlers
+	void execute(const uint8_t* mask, uint16_t opcode) {
+		const uint8_t x = (opcode & 0x0F00u) >> 8u;
+		const uint8_t y = (opcode & 0x00F0u) >> 4u;
+		const uint8_t kk = opcode & 0x00FFu;
+		const uint16_t nnn = opcode & 0x0FFFu;
+		uint8_t* VX = V[x];
+		uint8_t* VY = V[y];
+		uint8_t* VF = V[0xF];
+
+		blend(pc, mask, [this](unsigned int lane) { return pc[lane] + 2u; });
+
+		switch (Chip8::Decode(opcode)) {
+		case OPID_00E0:
+			for (unsigned int row = 0; row < SCREEN_HEIGHT; row++) blend(screen[row], mask, [](unsigned int) { return 0; });
+			blend(displayGeneration, mask, [this](unsigned int lane) { return displayGeneration[lane] + 1u; });
+			blend(dirtyRows, mask, [](unsigned int) { return ~0u; });
+			break;
+		case OPID_00EE:
+			forLanes(mask, [this](unsigned int lane) {
+				sp[lane] = (sp[lane] - 1u) & 0xFu;
+				pc[lane] = stack[sp[lane]][lane];
+			});
+			break;
+		case OPID_1nnn: blend(pc, mask, [nnn](unsigned int) { return nnn; }); break;
+		case OPID_2nnn:
+			forLanes(mask, [this, nnn](unsigned int lane) {
+				stack[sp[lane] & 0xFu][lane] = pc[lane];
+				sp[lane] = (sp[lane] + 1u) & 0xFu;
+				pc[lane] = nnn;
+			});
+			break;
+		case OPID_3xkk: blend(pc, mask, [this, VX, kk](unsigned int lane) { return pc[lane] + (VX[lane] == kk ? 2u : 0u); }); break;
+		case OPID_4xkk: blend(pc, mask, [this, VX, kk](unsigned int lane) { return pc[lane] + (VX[lane] != kk ? 2u : 0u); }); break;
+		case OPID_5xy0: blend(pc, mask, [this, VX, VY](unsigned int lane) { return pc[lane] + (VX[lane] == VY[lane] ? 2u : 0u); }); break;
+		case OPID_9xy0: blend(pc, mask, [this, VX, VY](unsigned int lane) { return pc[lane] + (VX[lane] != VY[lane] ? 2u : 0u); }); break;
+		case OPID_6xkk: blend(VX, mask, [kk](unsigned int) { return kk; }); break;
+		case OPID_7xkk: blend(VX, mask, [VX, kk](unsigned int lane) { return VX[lane] + kk; }); break;
+		case OPID_8xy0: blend(VX, mask, [VY](unsigned int lane) { return VY[lane]; }); break;
+		case OPID_8xy1: blend(VX, mask, [VX, VY](unsigned int lane) { return VX[lane] | VY[lane]; }); break;
+		case OPID_8xy2: blend(VX, mask, [VX, VY](unsigned int lane) { return VX[lane] & VY[lane]; }); break;
+		case OPID_8xy3: blend(VX, mask, [VX, VY](unsigned int lane) { return VX[lane] ^ VY[lane]; }); break;
+		case OPID_8xy4: {
+			alignas(64) uint8_t sum[Lanes];
+			for (unsigned int lane = 0; lane < Lanes; lane++) sum[lane] = (uint8_t)(VX[lane] + VY[lane]);
+			blend(VF, mask, [VX, VY](unsigned int lane) { return VX[lane] + VY[lane] > 255u; });
+			blend(VX, mask, [&sum](unsigned int lane) { return sum[lane]; });
+			break;
+		}
+		case OPID_8xy5:
+		case OPID_8xy7: // Same as 8xy5 in the interpreter. VF is written first and the operands are read again.
+			blend(VF, mask, [VX, VY](unsigned int lane) { return VX[lane] > VY[lane]; });
+			blend(VX, mask, [VX, VY](unsigned int lane) { return VX[lane] - VY[lane]; });
+			break;
+		case OPID_8xy6:
+			blend(VF, mask, [VX](unsigned int lane) { return VX[lane] & 1u; });
+			blend(VX, mask, [VX](unsigned int lane) { return VX[lane] >> 1u; });
+			break;
+		case OPID_8xyE:
+			blend(VF, mask, [VX](unsigned int lane) { return VX[lane] & 1u; });
+			blend(VX, mask, [VX](unsigned int lane) { return VX[lane] << 1u; });
+			break;
+		case OPID_Annn: blend(index, mask, [nnn](unsigned int) { return nnn; }); break;
+		case OPID_Bnnn: blend(pc, mask, [this, nnn](unsigned int lane) { return nnn + V[0][lane]; }); break;
+		case OPID_Cxkk: forLanes(mask, [this, VX, kk](unsigned int lane) { VX[lane] = rng[lane].NextByte() & kk; }); break;
+		case OPID_Dxyn: forLanes(mask, [this, x, y, opcode](unsigned int lane) { draw(lane, V[x][lane], V[y][lane], opcode & 0x000Fu); }); break;
+		case OPID_Ex9E: blend(pc, mask, [this, VX](unsigned int lane) { return pc[lane] + (keypad[VX[lane] & 0xFu][lane] ? 2u : 0u); }); break;
+		case OPID_ExA1: blend(pc, mask, [this, VX](unsigned int lane) { return pc[lane] + (keypad[VX[lane] & 0xFu][lane] ? 0u : 2u); }); break;
+		case OPID_Fx07: blend(VX, mask, [this](unsigned int lane) { return delayTimer[lane]; }); break;
+		case OPID_Fx0A:
+			blend(keyWaitRegister, mask, [x](unsigned int) { return x; });
+			blend(keyWaitPressed, mask, [](unsigned int) { return 0; });
+			blend(waiting, mask, [](unsigned int) { return 1; });
+			break;
+		case OPID_Fx15: blend(delayTimer, mask, [VX](unsigned int lane) { return VX[lane]; }); break;
+		case OPID_Fx18: blend(soundTimer, mask, [VX](unsigned int lane) { return VX[lane]; }); break;
+		case OPID_Fx1E: blend(index, mask, [this, VX](unsigned int lane) { return index[lane] + VX[lane]; }); break;
+		case OPID_Fx29: blend(index, mask, [VX](unsigned int lane) { return FONTSET_START_ADDRESS + VX[lane] * 5u; }); break;
+		case OPID_Fx33:
+			forLanes(mask, [this, VX](unsigned int lane) {
+				uint8_t value = VX[lane];
+				memory[index[lane] & 0xFFFu][lane] = value / 100;
+				memory[(index[lane] + 1u) & 0xFFFu][lane] = (value / 10) % 10;
+				memory[(index[lane] + 2u) & 0xFFFu][lane] = value % 10;
+			});
+			break;
+		case OPID_Fx55:
+			forLanes(mask, [this, x](unsigned int lane) {
+				for (unsigned int i = 0; i <= x; i++) memory[(index[lane] + i) & 0xFFFu][lane] = V[i][lane];
+			});
+			break;
+		case OPID_Fx65:
+			for (unsigned int i = 0; i <= x; i++) {
+				blend(V[i], mask, [this, i](unsigned int lane) { return memory[(index[lane] + i) & 0xFFFu][lane]; });
+			}
+			break;
+		default: // OPID_NULL
+			break;
+		}
+	}
+
+	// Lanes of the mask one at a time, for the instructions that index memory or the stack per lane
+	template <typename Body>
+	static void forLanes(const uint8_t* mask, Body body) {
+		for (unsigned int lane = 0; lane < Lanes; lane++) {
+			if (mask[lane]) body(lane);
+		}
+	}
+
+	// Same as Chip8::OP_Dxyn for one lane
+	void draw(unsigned int lane, uint8_t vx, uint8_t vy, unsigned int byteCount) {
+		unsigned int xCoord = vx % SCREEN_WIDTH;
+		unsigned int yCoord = vy % SCREEN_HEIGHT;
+		unsigned int rowCount = std::min<unsigned int>(byteCount, SCREEN_HEIGHT - yCoord);
+
+		uint64_t collision = 0;
+		uint32_t changedRows = 0;
+		for (unsigned int row = 0; row < rowCount; ++row) {
+			uint64_t spriteRow = ((uint64_t)memory[(index[lane] + row) & 0xFFFu][lane] << 56u) >> xCoord;
+			collision |= screen[yCoord + row][lane] & spriteRow;
+			screen[yCoord + row][lane] ^= spriteRow;
+			changedRows |= (uint32_t)(spriteRow != 0) << (yCoord + row);
+		}
+		V[0xF][lane] = collision != 0;
+		if (changedRows != 0) {
+			displayGeneration[lane]++;
+			dirtyRows[lane] |= changedRows;
+		}
+	}
+};
@@ -0,0 +1,315 @@
+/*
+Chip-8 Emulator -- input movies, file format (see Movie.h)
+*/
+
+#include "Movie.h"
+#include <algorithm>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char MOVIE_MAGIC[4] = { 'C', '8', 'M', 'V' };
+constexpr std::streamoff MOVIE_TRAILER_OFFSET = 32;	// Where the fields filled in by Close() start
+constexpr size_t MOVIE_HEADER_SIZE = 72;
+constexpr uint8_t RECORD_KEYFRAME = 0x40;
+constexpr uint8_t RECORD_PRESSED = 0x80;
+
+template <typename T>
+void put(std::ostream& out, T value) {
+	char bytes[sizeof(T)];
+	for (unsigned int i = 0; i < sizeof(T); i++) bytes[i] = (char)((uint64_t)value >> (8u * i));
+	out.write(bytes, sizeof(T));
+}
+
+template <typename T>
+T get(const uint8_t* data) {
+	uint64_t value = 0;
+	for (unsigned int i = 0; i < sizeof(T); i++) value |= (uint64_t)data[i] << (8u * i);
+	return (T)value;
+}
+
+} // namespace
+
+bool MovieWriter::Open(const char* filename, const MovieHeader& header) {
+	file.open(filename, std::ios::binary | std::ios::trunc);
+	if (!file) return false;
+
+	keyframeInterval = std::max(header.keyframeInterval, 1u);
+	file.write(MOVIE_MAGIC, sizeof(MOVIE_MAGIC));
+	put<uint16_t>(file, MOVIE_VERSION);
+	put<uint16_t>(file, 0u);
+	put<uint32_t>(file, header.instructionsPerFrame);
+	put<uint32_t>(file, keyframeInterval);
+	put<uint64_t>(file, header.seed);
+	put<uint64_t>(file, header.romHash);
+	for (unsigned int field = 0; field < 5; field++) put<uint64_t>(file, 0u);
+	file.flush();
+	lastFrame = 0;
+	eventCount = 0;
+	keyframes.clear();
+	return (bool)file;
+}
+
+void MovieWriter::putRecord(uint64_t frame, uint8_t type) {
+	uint64_t delta = frame - lastFrame;
+	while (delta >= 0x80) {
+		file.put((char)(delta | 0x80));
+		delta >>= 7;
+	}
+	file.put((char)delta);
+	file.put((char)type);
+	lastFrame = frame;
+}
+
+void MovieWriter::BeginFrame(const Chip8& chip8, uint64_t frame) {
+	if (frame % keyframeInterval != 0) return;
+
+	std::vector<uint8_t> state = chip8.SaveState();
+	keyframes.push_back(Keyframe{ frame, (uint64_t)file.tellp() });
+	putRecord(frame, RECORD_KEYFRAME);
+	put<uint32_t>(file, (uint32_t)state.size());
+	file.write(reinterpret_cast<const char*>(state.data()), (std::streamsize)state.size());
+}
+
+void MovieWriter::Record(uint64_t frame, uint8_t key, bool pressed) {
+	putRecord(frame, (uint8_t)((key & 0xFu) | (pressed ? RECORD_PRESSED : 0u)));
+	eventCount++;
+}
+
+bool MovieWriter::Close(uint64_t frames, uint64_t finalStateHash) {
+	uint64_t indexOffset = (uint64_t)file.tellp();
+	for (const Keyframe& keyframe : keyframes) {
+		put<uint64_t>(file, keyframe.frame);
+		put<uint64_t>(file, keyframe.offset);
+	}
+
+	file.seekp(MOVIE_TRAILER_OFFSET);
+	put<uint64_t>(file, frames);
+	put<uint64_t>(file, finalStateHash);
+	put<uint64_t>(file, eventCount);
+	put<uint64_t>(file, indexOffset);
+	put<uint64_t>(file, (uint64_t)keyframes.size());
+	bool ok = (bool)file;
+	file.close();
+	return ok;
+}
+
+bool MappedFile::Open(const char* filename) {
+	Close();
+#if defined(_WIN32)
+	HANDLE handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (handle == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(handle, &fileSize) || fileSize.QuadPart == 0) {
+		CloseHandle(handle);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	const void* view = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (view == nullptr) {
+		if (mapping != nullptr) CloseHandle(mapping);
+		CloseHandle(handle);
+		return false;
+	}
+	fileHandle = handle;
+	mappingHandle = mapping;
+	data = static_cast<const uint8_t*>(view);
+	size = (size_t)fileSize.QuadPart;
+#else
+	int descriptor = ::open(filename, O_RDONLY);
+	if (descriptor < 0) return false;
+	struct stat info;
+	if (fstat(descriptor, &info) != 0 || info.st_size == 0) {
+		::close(descriptor);
+		return false;
+	}
+	void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+	::close(descriptor); // The mapping keeps the file open
+	if (view == MAP_FAILED) return false;
+	data = static_cast<const uint8_t*>(view);
+	size = (size_t)info.st_size;
+#endif
+	return true;
+}
+
+void MappedFile::Close() {
+	if (data == nullptr) return;
+#if defined(_WIN32)
+	UnmapViewOfFile(data);
+	CloseHandle(mappingHandle);
+	CloseHandle(fileHandle);
+#else
+	munmap(const_cast<uint8_t*>(data), size);
+#endif
+	data = nullptr;
+	size = 0;
+}
+
+bool MovieReader::readRecord(size_t& offset, uint64_t& recordFrame, Record& record) const {
+	const uint8_t* data = file.Data();
+	uint64_t delta = 0;
+	for (unsigned int shift = 0;; shift += 7) {
+		if (offset >= recordsEnd || shift > 63) return false;
+		uint8_t byte = data[offset++];
+		delta |= (uint64_t)(byte & 0x7Fu) << shift;
+		if (byte < 0x80) break;
+	}
+	if (offset >= recordsEnd) return false;
+	record.type = data[offset++];
+	record.frame = recordFrame + delta;
+
+	if (record.type == RECORD_KEYFRAME) {
+		if (recordsEnd - offset < sizeof(uint32_t)) return false;
+		record.stateSize = get<uint32_t>(&data[offset]);
+		offset += sizeof(uint32_t);
+		if (recordsEnd - offset < record.stateSize) return false;
+		record.state = &data[offset];
+		offset += record.stateSize;
+	}
+	else if (record.type & 0x70u) {
+		return false; // Not a record, the file is damaged from here on
+	}
+	recordFrame = record.frame;
+	return true;
+}
+
+bool MovieReader::Open(const char* filename, std::string& error) {
+	if (!file.Open(filename)) {
+		error = "cannot open " + std::string(filename);
+		return false;
+	}
+	const uint8_t* data = file.Data();
+	if (file.Size() < MOVIE_HEADER_SIZE || !std::equal(std::begin(MOVIE_MAGIC), std::end(MOVIE_MAGIC), data)) {
+		error = "not a movie file";
+		return false;
+	}
+	if (get<uint16_t>(&data[4]) != MOVIE_VERSION) {
+		error = "movie version " + std::to_string(get<uint16_t>(&data[4])) + ", expected " + std::to_string(MOVIE_VERSION);
+		return false;
+	}
+
+	header.instructionsPerFrame = get<uint32_t>(&data[8]);
+	header.keyframeInterval = get<uint32_t>(&data[12]);
+	header.seed = get<uint64_t>(&data[16]);
+	header.romHash = get<uint64_t>(&data[24]);
+	header.frames = get<uint64_t>(&data[32]);
+	header.finalStateHash = get<uint64_t>(&data[40]);
+	eventCount = get<uint64_t>(&data[48]);
+	uint64_t indexOffset = get<uint64_t>(&data[56]);
+	uint64_t keyframeCount = get<uint64_t>(&data[64]);
+	if (header.instructionsPerFrame == 0) {
+		error = "no instructions per frame";
+		return false;
+	}
+
+	keyframes.clear();
+	complete = indexOffset != 0;
+	if (complete) {
+		if (indexOffset < MOVIE_HEADER_SIZE || indexOffset > file.Size() || (file.Size() - indexOffset) / 16 < keyframeCount) {
+			error = "bad keyframe index";
+			return false;
+		}
+		recordsEnd = (size_t)indexOffset;
+		for (uint64_t i = 0; i < keyframeCount; i++) {
+			const uint8_t* entry = &data[indexOffset + 16 * i];
+			uint64_t offset = get<uint64_t>(entry + 8);
+			if (offset < MOVIE_HEADER_SIZE || offset >= indexOffset) {
+				error = "bad keyframe index";
+				return false;
+			}
+			keyframes.push_back(Keyframe{ get<uint64_t>(entry), (size_t)offset });
+		}
+	}
+	else { // Never closed: no index, walk the records up to the last complete one
+		recordsEnd = file.Size();
+		size_t offset = MOVIE_HEADER_SIZE;
+		size_t lastComplete = offset;
+		uint64_t recordFrame = 0;
+		Record record;
+		while (readRecord(offset, recordFrame, record)) {
+			if (record.type == RECORD_KEYFRAME) keyframes.push_back(Keyframe{ record.frame, lastComplete });
+			lastComplete = offset;
+			header.frames = record.frame + 1;
+		}
+		recordsEnd = lastComplete;
+	}
+
+	position = MOVIE_HEADER_SIZE;
+	positionFrame = 0;
+	frame = 0;
+	return true;
+}
+
+bool MovieReader::Seek(Chip8& chip8, uint64_t target) {
+	if (target > header.frames) return false;
+	auto keyframe = std::upper_bound(keyframes.begin(), keyframes.end(), target,
+		[](uint64_t frame, const Keyframe& keyframe) { return frame < keyframe.frame; });
+	if (keyframe == keyframes.begin()) return false;
+	--keyframe;
+
+	size_t offset = keyframe->offset;
+	uint64_t recordFrame = 0;
+	Record record;
+	if (!readRecord(offset, recordFrame, record) || record.type != RECORD_KEYFRAME || !chip8.LoadState(record.state, record.stateSize)) {
+		return false;
+	}
+	position = offset;
+	positionFrame = keyframe->frame;
+	frame = keyframe->frame;
+
+	while (frame < target) {
+		FeedFrame(chip8);
+		chip8.RunFrame(header.instructionsPerFrame);
+	}
+	return true;
+}
+
+void MovieReader::FeedFrame(Chip8& chip8) {
+	Record record;
+	for (;;) {
+		size_t offset = position;
+		uint64_t recordFrame = positionFrame;
+		if (!readRecord(offset, recordFrame, record) || record.frame > frame) break;
+		if (record.type != RECORD_KEYFRAME) chip8.KeyEvent(record.type & 0xFu, (record.type & RECORD_PRESSED) != 0);
+		position = offset;
+		positionFrame = recordFrame;
+	}
+	frame++;
+}
+
+void MovieReader::Events(std::vector<InputEvent>& events) const {
+	events.clear();
+	size_t offset = MOVIE_HEADER_SIZE;
+	uint64_t recordFrame = 0;
+	Record record;
+	while (readRecord(offset, recordFrame, record)) {
+		if (record.type != RECORD_KEYFRAME) events.push_back(InputEvent{ record.frame, (uint8_t)(record.type & 0xFu), (record.type & RECORD_PRESSED) != 0 });
+	}
+}
+
+bool loadMovie(const char* filename, Movie& movie, std::string& error) {
+	MovieReader reader;
+	if (!reader.Open(filename, error)) return false;
+	movie.header = reader.Header();
+	movie.complete = reader.Complete();
+	reader.Events(movie.events);
+	if (movie.complete && movie.events.size() != reader.RecordedEvents()) {
+		error = "events do not match the header (truncated file?)";
+		return false;
+	}
+	return true;
+}
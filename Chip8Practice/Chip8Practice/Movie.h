@@ -0,0 +1,155 @@
+/*
+Chip-8 Emulator -- input movies
+A movie is everything needed to play a run again bit for bit: the RND seed, the instructions
+per frame, a hash of the ROM and every keypad event with the frame it was delivered on. The
+frontend records them (--record) and replays them (--replay), the headless runner replays
+them unthrottled. Records go to the file as they happen, so a recording cut short by a crash
+still plays back up to its last complete record.
+
+Every keyframeInterval frames the whole machine is stored as well (Chip8::SaveState), and an
+index of those keyframes is appended when the recording is closed, so a reader can start at
+any frame by loading the nearest keyframe before it and running at most keyframeInterval
+frames. Readers map the file into memory and only decode what they go through.
+
+File layout, every field little-endian:
+	"C8MV", version, flags, instructions per frame, keyframe interval, seed, ROM hash (hashProgram()),
+	frames, final state hash (hashState()), event count, index offset, keyframe count,
+	then the records, each <frame delta varint> <type byte> ...:
+		key | pressed << 7		a keypad event, delivered before the instructions of its frame
+		0x40 <u32 size> <state>	a keyframe, the machine at the start of its frame (before its events)
+	then the index, one <frame u64> <record offset u64> pair per keyframe
+Everything from frames on is zero until the recording is closed.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <fstream>
+#include "Chip8.h"
+#include "HeadlessRun.h"
+
+constexpr uint16_t MOVIE_VERSION = 2;
+constexpr uint32_t DEFAULT_KEYFRAME_INTERVAL = 10 * FRAME_RATE;	// Seeks run at most 10 seconds of frames
+
+struct MovieHeader {
+	uint32_t instructionsPerFrame = DEFAULT_INSTRUCTIONS_PER_FRAME;
+	uint64_t seed = 0;
+	uint64_t romHash = 0;			// hashProgram() right after the ROM was loaded
+	uint32_t keyframeInterval = DEFAULT_KEYFRAME_INTERVAL;
+	uint64_t frames = 0;			// Length of the run, 0 for a recording that was not closed
+	uint64_t finalStateHash = 0;	// hashState() after the last frame
+};
+
+struct Movie {
+	MovieHeader header;
+	std::vector<InputEvent> events;	// In delivery order, frames never decrease
+	bool complete = false;			// Closed properly: frames and finalStateHash can be trusted
+};
+
+// Streams a movie to disk while the run is recorded, append only until Close()
+class MovieWriter {
+public:
+	bool Open(const char* filename, const MovieHeader& header);
+
+	// Called at the start of every frame, before its events: stores a keyframe every keyframeInterval frames
+	void BeginFrame(const Chip8& chip8, uint64_t frame);
+
+	// Appends a keypad event delivered before the instructions of the given frame
+	void Record(uint64_t frame, uint8_t key, bool pressed);
+
+	// Writes the keyframe index and fills in the length and final state of the run, false if the file could not be written
+	bool Close(uint64_t frames, uint64_t finalStateHash);
+
+	bool IsOpen() const { return file.is_open(); }
+
+private:
+	struct Keyframe {
+		uint64_t frame;
+		uint64_t offset;
+	};
+
+	std::ofstream file;
+	uint32_t keyframeInterval = DEFAULT_KEYFRAME_INTERVAL;
+	uint64_t lastFrame = 0;
+	uint64_t eventCount = 0;
+	std::vector<Keyframe> keyframes;
+
+	void putRecord(uint64_t frame, uint8_t type);
+};
+
+// Read-only view of a whole file (mmap, or a file mapping on Windows)
+class MappedFile {
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile() { Close(); }
+
+	bool Open(const char* filename);
+	void Close();
+
+	const uint8_t* Data() const { return data; }
+	size_t Size() const { return size; }
+
+private:
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+#if defined(_WIN32)
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+#endif
+};
+
+// Plays a movie from any frame: Seek() restores the nearest keyframe and runs up to the frame,
+// FeedFrame() then delivers the input of one frame at a time
+class MovieReader {
+public:
+	// Maps the file and finds the keyframes (from the index, or by walking the records of a recording that was not closed)
+	bool Open(const char* filename, std::string& error);
+
+	const MovieHeader& Header() const { return header; }
+	bool Complete() const { return complete; }
+	size_t Keyframes() const { return keyframes.size(); }
+	uint64_t Frame() const { return frame; }		// Next frame FeedFrame() delivers the input of
+	uint64_t RecordedEvents() const { return eventCount; }	// Event count from the header, 0 when not closed
+
+	// Puts chip8 at the start of the given frame (before its input), false if the movie does not reach it
+	bool Seek(Chip8& chip8, uint64_t target);
+
+	// Delivers the keypad events of Frame() to chip8 and moves on to the next frame (the caller runs the frame)
+	void FeedFrame(Chip8& chip8);
+
+	// Every keypad event of the movie, in order
+	void Events(std::vector<InputEvent>& events) const;
+
+private:
+	struct Keyframe {
+		uint64_t frame;
+		size_t offset;
+	};
+
+	struct Record {
+		uint64_t frame;
+		uint8_t type;
+		const uint8_t* state;	// Keyframes only
+		uint32_t stateSize;
+	};
+
+	MappedFile file;
+	MovieHeader header;
+	bool complete = false;
+	uint64_t eventCount = 0;
+	size_t recordsEnd = 0;		// The index, or the end of the last complete record
+	std::vector<Keyframe> keyframes;
+	size_t position = 0;		// Next record to read
+	uint64_t positionFrame = 0;	// Frame of the record before it (record frames are deltas)
+	uint64_t frame = 0;
+
+	bool readRecord(size_t& offset, uint64_t& recordFrame, Record& record) const;
+};
+
+// Reads a movie's header and events, false with a message in error when the file is not one (or another version of it)
+bool loadMovie(const char* filename, Movie& movie, std::string& error);
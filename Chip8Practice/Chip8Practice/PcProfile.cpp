@@ -0,0 +1,113 @@
+/*
+Chip-8 Emulator -- program counter profile, reports (see PcProfile.h)
+*/
+
+#include "PcProfile.h"
+#include "Chip8.h"
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+#include <string>
+
+std::string PcProfile::Name(uint32_t node) const {
+	if (node == 0) return "main";
+	if (nodes[node].target == UNKNOWN_TARGET) return "sub_unknown";
+	char name[16];
+	std::snprintf(name, sizeof(name), "sub_%03x", nodes[node].target);
+	return name;
+}
+
+void PcProfile::PrintFlat(std::ostream& out, const uint8_t* memory, size_t top) const {
+	uint64_t total = 0;
+	for (uint64_t count : cycles) total += count;
+	if (total == 0) {
+		out << "PC profile: nothing ran\n" << std::flush;
+		return;
+	}
+
+	// Basic blocks: straight runs of executed addresses, cut where an instruction was jumped to
+	// or where the one before ends a block (jump, call, return, skip, store, key wait)
+	struct Block {
+		uint16_t start, end;	// First and last instruction
+		uint64_t cycles;
+	};
+	std::vector<Block> blocks;
+	std::bitset<4096> covered;
+	for (unsigned int start = 0; start < 4096; start++) {
+		if (cycles[start] == 0 || covered[start]) continue;
+		Block block{ (uint16_t)start, (uint16_t)start, 0 };
+		for (unsigned int address = start; address < 4096 && cycles[address] != 0 && !covered[address]; address += 2) {
+			if (address != start && entered[address]) break;
+			covered.set(address);
+			block.end = (uint16_t)address;
+			block.cycles += cycles[address];
+			uint16_t opcode = (uint16_t)((memory[address] << 8u) | memory[(address + 1) & 0x0FFFu]);
+			if (endsBasicBlock(decodeOpcode(opcode))) break;
+		}
+		blocks.push_back(block);
+	}
+	std::sort(blocks.begin(), blocks.end(), [](const Block& a, const Block& b) { return a.cycles > b.cycles; });
+
+	// Subroutines: own cycles summed over every path they ran in, inclusive ones counted once per
+	// path from the outermost call (so recursion is not counted twice)
+	std::vector<uint64_t> inclusive(nodes.size());
+	for (size_t i = nodes.size(); i-- > 0;) { // Children always come after their parent
+		inclusive[i] += nodes[i].self;
+		if (i != 0) inclusive[nodes[i].parent] += inclusive[i];
+	}
+	struct Routine {
+		uint32_t node;		// First node found for it, names it
+		uint64_t self, inclusive, calls;
+	};
+	std::vector<Routine> routines;
+	std::unordered_map<uint32_t, size_t> byTarget;
+	for (uint32_t i = 0; i < nodes.size(); i++) {
+		uint32_t target = i == 0 ? 0x10000u : nodes[i].target; // The top level is not a target
+		auto found = byTarget.emplace(target, routines.size());
+		if (found.second) routines.push_back(Routine{ i, 0, 0, 0 });
+		Routine& routine = routines[found.first->second];
+		routine.self += nodes[i].self;
+		routine.calls += nodes[i].calls;
+		bool nested = false;
+		for (uint32_t parent = i; parent != 0 && !nested;) {
+			parent = nodes[parent].parent;
+			nested = parent != 0 && nodes[parent].target == nodes[i].target;
+		}
+		if (!nested) routine.inclusive += inclusive[i];
+	}
+	std::sort(routines.begin(), routines.end(), [](const Routine& a, const Routine& b) { return a.inclusive > b.inclusive; });
+
+	std::ios_base::fmtflags flags = out.flags();
+	char fill = out.fill(' ');
+	out << "PC profile: " << total << " instructions, " << blocks.size() << " basic blocks, " << routines.size() - 1 << " subroutines\n"
+		<< "block            cycles     share\n" << std::fixed << std::setprecision(2) << std::hex;
+	for (size_t i = 0; i < std::min(top, blocks.size()); i++) {
+		out << std::setfill('0') << std::setw(3) << blocks[i].start << "-" << std::setw(3) << blocks[i].end
+			<< std::setfill(' ') << std::dec << std::setw(14) << blocks[i].cycles
+			<< std::setw(9) << 100.0 * blocks[i].cycles / total << "%\n" << std::hex;
+	}
+	out << std::dec << "routine            self     share     inclusive     share      calls\n";
+	for (size_t i = 0; i < std::min(top, routines.size()); i++) {
+		const Routine& routine = routines[i];
+		out << std::left << std::setw(11) << Name(routine.node) << std::right
+			<< std::setw(10) << routine.self << std::setw(9) << 100.0 * routine.self / total << "%"
+			<< std::setw(14) << routine.inclusive << std::setw(9) << 100.0 * routine.inclusive / total << "%"
+			<< std::setw(11) << routine.calls << "\n";
+	}
+	out.flags(flags);
+	out.fill(fill);
+	out << std::flush;
+}
+
+void PcProfile::WriteCollapsed(std::ostream& out) const {
+	std::vector<uint32_t> path;
+	for (uint32_t i = 0; i < nodes.size(); i++) {
+		if (nodes[i].self == 0) continue;
+		path.clear();
+		for (uint32_t node = i; node != 0; node = nodes[node].parent) path.push_back(node);
+		out << "main";
+		for (size_t level = path.size(); level-- > 0;) out << ";" << Name(path[level]);
+		out << " " << nodes[i].self << "\n";
+	}
+	out << std::flush;
+}
@@ -0,0 +1,117 @@
+/*
+Chip-8 Emulator -- program counter profile
+Counts the instructions executed at every address and the call path they ran under, so the
+hot parts of a ROM can be found: which basic blocks and which subroutines (2nnn targets)
+take the cycles. Filled in by Chip8::Run() while Chip8::pcProfile points to one.
+
+The call path is a node of a call tree, one node per distinct chain of call targets from
+the program's top level. It is worked out from the Chip8 stack: every entry is a return
+address, and the 2nnn just before it names the subroutine that was called. Instructions
+count towards the node they ran in, which is all a collapsed-stack file (the input of
+flamegraph.pl and speedscope) needs.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <bitset>
+#include <iosfwd>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class PcProfile {
+public:
+	static constexpr uint16_t UNKNOWN_TARGET = 0xFFFF;	// A return address with no 2nnn before it (self-modified code)
+
+	PcProfile() {
+		nodes.push_back(Node{ 0, UNKNOWN_TARGET, 0, 0 });
+	}
+
+	// Called before running, in case something other than the instructions counted changed the stack (LoadState).
+	// Works the call path out again from the stack if it does not start like the one followed so far.
+	void Enter(const uint16_t* stack, uint8_t sp, const uint8_t* memory) {
+		if (std::memcmp(stack, returns, std::min(sp, depth) * sizeof(uint16_t)) == 0) return; // Count() carries on from here
+		Resync(stack, sp, memory);
+	}
+
+	// Called before the instruction at pc runs, with the stack as it is then
+	void Count(uint16_t pc, const uint16_t* stack, uint8_t sp, const uint8_t* memory) {
+		if (sp != depth) {
+			if (sp == depth + 1 && depth < 16) { // 2nnn
+				node = Child(node, CallTarget(stack[depth], memory));
+				nodes[node].calls++;
+				returns[depth] = stack[depth];
+				depth = sp;
+			}
+			else if (sp + 1 == depth && node != 0) { // 00EE
+				node = nodes[node].parent;
+				depth = sp;
+			}
+			else {
+				Resync(stack, sp, memory);
+			}
+		}
+
+		pc &= 0x0FFFu;
+		cycles[pc]++;
+		if (pc != expectedPc) entered.set(pc); // Reached by a jump, call, return or skip: starts a block
+		expectedPc = (uint16_t)(pc + 2);
+		nodes[node].self++;
+	}
+
+	// Instructions executed at each address
+	uint64_t Cycles(uint16_t address) const { return cycles[address & 0x0FFFu]; }
+
+	// Prints the hottest basic blocks (recovered from the addresses executed and the code in memory) and
+	// every subroutine with its own and its inclusive cycles, at most top lines each
+	void PrintFlat(std::ostream& out, const uint8_t* memory, size_t top = 20) const;
+
+	// One "main;sub_234;sub_2a0 <cycles>" line per call path that ran instructions
+	void WriteCollapsed(std::ostream& out) const;
+
+private:
+	static constexpr uint16_t NO_PC = 0xFFFF;
+
+	struct Node {
+		uint32_t parent;
+		uint16_t target;	// Subroutine entered, UNKNOWN_TARGET for the root
+		uint64_t self;		// Instructions run in it, not in what it called
+		uint64_t calls;
+	};
+
+	uint64_t cycles[4096]{};
+	std::bitset<4096> entered;		// Addresses executed other than straight after the one before
+	std::vector<Node> nodes;		// Call tree, the root (top level) first
+	std::unordered_map<uint64_t, uint32_t> children;	// (parent << 16 | target) to node
+	uint32_t node = 0;
+	uint8_t depth = 0;				// sp the current node was worked out for
+	uint16_t returns[16]{};			// The stack it was worked out from
+	uint16_t expectedPc = NO_PC;
+
+	void Resync(const uint16_t* stack, uint8_t sp, const uint8_t* memory) {
+		node = 0;
+		depth = std::min<uint8_t>(sp, 16);
+		for (uint8_t level = 0; level < depth; level++) {
+			node = Child(node, CallTarget(stack[level], memory));
+			returns[level] = stack[level];
+		}
+	}
+
+	static uint16_t CallTarget(uint16_t returnAddress, const uint8_t* memory) {
+		if (returnAddress < 2 || returnAddress > 4096) return UNKNOWN_TARGET;
+		uint16_t call = (uint16_t)((memory[returnAddress - 2] << 8u) | memory[returnAddress - 1]);
+		return (call & 0xF000u) == 0x2000u ? (uint16_t)(call & 0x0FFFu) : UNKNOWN_TARGET;
+	}
+
+	uint32_t Child(uint32_t parent, uint16_t target) {
+		auto inserted = children.emplace(((uint64_t)parent << 16u) | target, (uint32_t)nodes.size());
+		if (inserted.second) nodes.push_back(Node{ parent, target, 0, 0 });
+		return inserted.first->second;
+	}
+
+	std::string Name(uint32_t node) const;
+};
@@ -0,0 +1,244 @@
+/*
+Chip-8 Emulator -- ahead-of-time recompiler
+Recovers the control flow graph of a loaded ROM from START_ADDRESS and writes it out as a
+C++ translation unit: one label per reachable basic block, each instruction a call to the
+Chip8 handler with its opcode baked in (the compiler inlines and folds them at -O3).
+The generated Chip8AotRun(chip8, cycles) behaves like chip8.Run(cycles), falling back to the
+interpreter for anything it cannot reach statically (Bnnn, returns to unknown addresses,
+odd addresses) and for good once the ROM overwrites its own code.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <vector>
+#include <ostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include "Chip8.h"
+
+// Built-in program translated and checked when no ROM is given: a draw loop, a call and a
+// computed jump (Bnnn) into code that is never translated, which rewrites an instruction of
+// a translated block (the LD V1 at 0x202, between 1 and 7) on every pass
+constexpr uint8_t AOT_TEST_ROM[] = {
+	0x60, 0x00,	// 200: LD V0, 0
+	0x61, 0x01,	// 202: LD V1, 1
+	0xA3, 0x00,	// 204: LD I, 0x300
+	0xD0, 0x15,	// 206: DRW V0, V1, 5
+	0x70, 0x01,	// 208: ADD V0, 1
+	0x30, 0x40,	// 20A: SE V0, 0x40
+	0x12, 0x04,	// 20C: JP 0x204
+	0x22, 0x12,	// 20E: CALL 0x212
+	0xB1, 0xDA,	// 210: JP V0, 0x1DA (0x21A)
+	0xC2, 0xFF,	// 212: RND V2, 0xFF
+	0xA3, 0x00,	// 214: LD I, 0x300
+	0xF2, 0x33,	// 216: LD B, V2
+	0x00, 0xEE,	// 218: RET
+	0xA2, 0x03,	// 21A: LD I, 0x203
+	0xF0, 0x65,	// 21C: LD V0, [I]
+	0x63, 0x06,	// 21E: LD V3, 6
+	0x80, 0x33,	// 220: XOR V0, V3
+	0xF0, 0x55,	// 222: LD [I], V0
+	0x12, 0x00	// 224: JP 0x200
+};
+
+class Recompiler {
+public:
+	explicit Recompiler(const Chip8& chip8) : memory(std::begin(chip8.memory), std::end(chip8.memory)) {
+		discover();
+	}
+
+	size_t BlockCount() const {
+		return blocks.size();
+	}
+
+	// Writes the translation unit, romName only ends up in a comment
+	void Emit(std::ostream& out, const std::string& romName) const {
+		out << "// Generated by the Chip-8 emulator (--aot) from " << romName << ", do not edit\n";
+		out << "#include \"Chip8.h\"\n\n";
+		out << "namespace {\n\n";
+		emitCodeImage(out);
+		out << "// Whether memory[address, address + size) no longer holds the code that was translated\n"
+			<< "bool codeChanged(const Chip8& c, unsigned int address, unsigned int size) {\n"
+			<< "\tfor (unsigned int i = address; i < address + size && i < CODE_END; i++) {\n"
+			<< "\t\tif (i >= CODE_START && COVERED[i - CODE_START] && c.memory[i] != CODE_IMAGE[i - CODE_START]) return true;\n"
+			<< "\t}\n"
+			<< "\treturn false;\n"
+			<< "}\n\n"
+			<< "} // namespace\n\n";
+
+		out << "void Chip8AotRun(Chip8& c, uint64_t cycles) {\n"
+			<< "\tif (c.waitingForKey) return;\n"
+			<< "\tif (codeChanged(c, CODE_START, CODE_END - CODE_START)) goto interpret;\n\n"
+			<< "dispatch:\n"
+			<< "\tswitch (c.pc) {\n";
+		for (const auto& entry : blocks) {
+			out << "\tcase 0x" << hex(entry.first) << ": goto " << label(entry.first) << ";\n";
+		}
+		out << "\tdefault: goto step;\n"
+			<< "\t}\n\n"
+			<< "step: // One instruction on the interpreter, pc is not the start of a translated block (or the block does not fit)\n"
+			<< "\tif (cycles == 0) return;\n"
+			<< "\tc.Cycle();\n"
+			<< "\tcycles--;\n"
+			<< "\tif (((c.opcode & 0xF0FFu) == 0xF033u || (c.opcode & 0xF0FFu) == 0xF055u) && codeChanged(c, CODE_START, CODE_END - CODE_START)) goto interpret;\n"
+			<< "\tif (c.waitingForKey) return;\n"
+			<< "\tgoto dispatch;\n\n"
+			<< "interpret: // The ROM rewrote its own code, the translation is stale\n"
+			<< "\tc.Run(cycles);\n"
+			<< "\treturn;\n";
+
+		for (const auto& entry : blocks) {
+			emitBlock(out, entry.second);
+		}
+		out << "}\n";
+	}
+private:
+	struct Block {
+		uint16_t start;
+		uint8_t length; // Instructions
+	};
+
+	std::vector<uint8_t> memory;
+	std::map<uint16_t, Block> blocks; // By start address, sorted for a stable output
+
+	uint16_t opcodeAt(unsigned int address) const {
+		return (uint16_t)((memory[address] << 8u) + memory[address + 1]);
+	}
+
+	static bool translatable(unsigned int address) {
+		return (address & 1u) == 0 && address >= START_ADDRESS && address + 1 < 4096;
+	}
+
+	// Walks every block reachable from START_ADDRESS, with the same block boundaries as BlockCache
+	void discover() {
+		std::vector<unsigned int> pending{ START_ADDRESS };
+
+		while (!pending.empty()) {
+			unsigned int start = pending.back();
+			pending.pop_back();
+			if (!translatable(start) || blocks.count((uint16_t)start) != 0) continue;
+
+			Block block{ (uint16_t)start, 0 };
+			unsigned int address = start;
+			uint8_t id = OPID_NULL;
+			while (translatable(address) && block.length < MAX_BLOCK_LENGTH) {
+				id = Chip8::Decode(opcodeAt(address));
+				block.length++;
+				address += 2;
+				if (endsBasicBlock(id)) break;
+			}
+			if (block.length == 0) continue;
+			blocks[block.start] = block;
+
+			uint16_t last = opcodeAt(address - 2);
+			uint16_t nnn = last & 0x0FFFu;
+			if (!endsBasicBlock(id)) {
+				pending.push_back(address);
+				continue;
+			}
+			switch (id) {
+			case OPID_1nnn: pending.push_back(nnn); break;
+			case OPID_2nnn: pending.push_back(nnn); pending.push_back(address); break; // The return lands after the call
+			case OPID_3xkk: case OPID_4xkk: case OPID_5xy0: case OPID_9xy0:
+			case OPID_Ex9E: case OPID_ExA1:
+				pending.push_back(address);
+				pending.push_back(address + 2);
+				break;
+			case OPID_Fx0A: case OPID_Fx33: case OPID_Fx55: pending.push_back(address); break;
+			default: break; // 00EE and Bnnn go through the dispatch switch
+			}
+		}
+	}
+
+	static std::string hex(unsigned int value) {
+		std::ostringstream text;
+		text << std::uppercase << std::hex << std::setw(3) << std::setfill('0') << value;
+		return text.str();
+	}
+
+	static std::string label(unsigned int address) {
+		return "L_" + hex(address);
+	}
+
+	// Jumps to a translated block when there is one at a constant address, through the dispatch switch otherwise
+	void emitGoto(std::ostream& out, unsigned int address) const {
+		if (blocks.count((uint16_t)address) != 0) out << "goto " << label(address) << ";";
+		else out << "goto dispatch;";
+	}
+
+	// The bytes every translated block was made from, to detect self-modifying code
+	void emitCodeImage(std::ostream& out) const {
+		unsigned int end = START_ADDRESS;
+		for (const auto& entry : blocks) {
+			end = std::max(end, entry.first + entry.second.length * 2u);
+		}
+
+		std::vector<uint8_t> covered(end - START_ADDRESS, 0);
+		for (const auto& entry : blocks) {
+			for (unsigned int i = 0; i < entry.second.length * 2u; i++) {
+				covered[entry.first - START_ADDRESS + i] = 1;
+			}
+		}
+
+		out << "constexpr unsigned int CODE_START = 0x" << hex(START_ADDRESS) << ";\n";
+		out << "constexpr unsigned int CODE_END = 0x" << hex(end) << ";\n\n";
+		out << "const uint8_t CODE_IMAGE[] = {";
+		for (unsigned int i = START_ADDRESS; i < end; i++) {
+			out << ((i - START_ADDRESS) % 16 == 0 ? "\n\t" : " ") << "0x" << std::hex << std::setw(2) << std::setfill('0') << (unsigned int)memory[i] << std::dec << ",";
+		}
+		out << "\n\t0\n};\n\n";
+		out << "const uint8_t COVERED[] = {";
+		for (size_t i = 0; i < covered.size(); i++) {
+			out << (i % 32 == 0 ? "\n\t" : " ") << (unsigned int)covered[i] << ",";
+		}
+		out << "\n\t0\n};\n\n";
+	}
+
+	void emitBlock(std::ostream& out, const Block& block) const {
+		unsigned int end = block.start + block.length * 2u;
+		out << "\n" << label(block.start) << ": // 0x" << hex(block.start) << "-0x" << hex(end - 1) << "\n"
+			<< "\tif (cycles < " << (unsigned int)block.length << ") goto step;\n"
+			<< "\tcycles -= " << (unsigned int)block.length << ";\n";
+
+		uint8_t id = OPID_NULL;
+		for (unsigned int address = block.start; address < end; address += 2) {
+			uint16_t opcode = opcodeAt(address);
+			id = Chip8::Decode(opcode);
+			if (endsBasicBlock(id)) out << "\tc.pc = 0x" << hex(address + 2) << ";\n"; // Only the block's last instruction can look at pc
+			out << "\tc.opcode = 0x" << std::uppercase << std::hex << std::setw(4) << std::setfill('0') << opcode << std::dec
+				<< "; c.OP_" << OPCODE_NAMES[id] << "();\n";
+		}
+
+		uint16_t last = opcodeAt(end - 2);
+		switch (endsBasicBlock(id) ? id : (uint8_t)OPID_NULL) {
+		case OPID_1nnn:
+		case OPID_2nnn:
+			out << "\t"; emitGoto(out, last & 0x0FFFu); out << "\n";
+			break;
+		case OPID_3xkk: case OPID_4xkk: case OPID_5xy0: case OPID_9xy0:
+		case OPID_Ex9E: case OPID_ExA1:
+			out << "\tif (c.pc == 0x" << hex(end) << ") "; emitGoto(out, end); out << "\n";
+			out << "\t"; emitGoto(out, end + 2); out << "\n";
+			break;
+		case OPID_Fx33:
+		case OPID_Fx55:
+			out << "\tif (codeChanged(c, c.index, " << (id == OPID_Fx33 ? 3u : ((last & 0x0F00u) >> 8u) + 1u) << ")) goto interpret;\n";
+			out << "\t"; emitGoto(out, end); out << "\n";
+			break;
+		case OPID_00EE:
+		case OPID_Bnnn:
+			out << "\tgoto dispatch;\n";
+			break;
+		case OPID_Fx0A:
+			out << "\treturn; // Halted until a key event\n";
+			break;
+		default: // A block cut at MAX_BLOCK_LENGTH
+			if (!endsBasicBlock(id)) out << "\tc.pc = 0x" << hex(end) << ";\n";
+			out << "\t"; emitGoto(out, end); out << "\n";
+			break;
+		}
+	}
+};
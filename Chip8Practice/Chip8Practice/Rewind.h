@@ -0,0 +1,234 @@
+/*
+Chip-8 Emulator -- rewind buffer
+Keeps the last frames of a run as Chip8State snapshots in a fixed-size byte ring. Every
+frame is stored XORed against the keyframe it belongs to (a keyframe against zeros) and
+run-length coded a 64-bit word at a time: runs of unchanged words are skipped, changed ones
+are stored as they are. Most of memory and of the screen stays put from one frame to the
+next, so a frame usually takes a few hundred bytes.
+
+Token format, repeated until the whole Chip8State is covered:
+	<unchanged words> <changed words> <changed words * 8 bytes>
+with both counts as LEB128 varints.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include "Chip8.h"
+
+static_assert(sizeof(Chip8State) % sizeof(uint64_t) == 0, "Rewind deltas work on whole words");
+
+// The frontend's default: 60 seconds of frames in 2 MB
+constexpr unsigned int REWIND_SECONDS = 60;
+constexpr size_t REWIND_BUDGET = 2u << 20;
+
+class RewindBuffer {
+public:
+	static constexpr size_t STATE_WORDS = sizeof(Chip8State) / sizeof(uint64_t);
+	static constexpr size_t MAX_ENCODED = sizeof(Chip8State) + 2 * 3 * STATE_WORDS;	// Worst case for one frame
+
+	// Room for up to maxFrames frames (a keyframe every keyframeInterval) in budgetBytes of encoded data.
+	// When the budget runs out the oldest frames go first, so fewer frames may be kept.
+	RewindBuffer(size_t maxFrames, size_t budgetBytes, unsigned int keyframeInterval = 60)
+		: entries(std::max<size_t>(maxFrames, 1)), data(std::max(budgetBytes, 2 * MAX_ENCODED)),
+		scratch(MAX_ENCODED), keyframeInterval(std::max(keyframeInterval, 1u)) {
+	}
+
+	// Records the machine as the newest frame, evicting the oldest ones as needed
+	void Push(const Chip8State& state) {
+		if (count == entries.size()) {
+			PopFront();
+			DropOrphans();
+		}
+
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&state);
+		bool keyframe = sinceKeyframe >= keyframeInterval || newestKeyframe == NO_FRAME;
+		size_t size, offset;
+		for (;;) {
+			size = Encode(bytes, keyframe ? Zeros() : Keyframe(newestKeyframe), scratch.data());
+			offset = Reserve(size);
+			if (keyframe || newestKeyframe != NO_FRAME) break;
+			keyframe = true; // Making room evicted the keyframe this delta was against
+		}
+		std::memcpy(&data[offset], scratch.data(), size);
+
+		uint64_t serial = firstSerial + count;
+		entries[(head + count) % entries.size()] = Entry{ offset, (uint32_t)size, keyframe ? serial : newestKeyframe };
+		count++;
+		writeOffset = offset + size;
+		bytesUsed += size;
+		if (keyframe) {
+			newestKeyframe = serial;
+			std::memcpy(&cachedKeyframe, &state, sizeof(Chip8State));
+			cachedSerial = serial;
+			sinceKeyframe = 0;
+		}
+		sinceKeyframe++;
+	}
+
+	// Removes the newest frame and writes it to state, false when there is nothing left to rewind to
+	bool Pop(Chip8State& state) {
+		if (count == 0) return false;
+		uint64_t serial = firstSerial + count - 1;
+		const Entry& entry = At(serial);
+		const uint8_t* base = entry.keyframe == serial ? Zeros() : Keyframe(entry.keyframe);
+		Decode(&data[entry.offset], entry.size, base, reinterpret_cast<uint8_t*>(&state));
+
+		count--;
+		bytesUsed -= entry.size;
+		writeOffset = entry.offset; // Newest data sits at the end of the ring, its space is free again
+		if (entry.keyframe == serial) {
+			newestKeyframe = NO_FRAME; // The next push starts a new keyframe
+		}
+		else {
+			sinceKeyframe--;
+		}
+		return true;
+	}
+
+	void Clear() {
+		firstSerial += count;
+		count = 0;
+		bytesUsed = 0;
+		newestKeyframe = NO_FRAME;
+	}
+
+	size_t Frames() const { return count; }
+	size_t BytesUsed() const { return bytesUsed; }		// Encoded frames currently held
+	size_t Capacity() const { return data.size(); }
+
+private:
+	static constexpr uint64_t NO_FRAME = ~(uint64_t)0;
+
+	struct Entry {
+		size_t offset;
+		uint32_t size;
+		uint64_t keyframe;	// Serial of the keyframe it was XORed against (its own for a keyframe)
+	};
+
+	std::vector<Entry> entries;		// Ring of frame records, oldest at head
+	std::vector<uint8_t> data;		// Ring of encoded frames
+	std::vector<uint8_t> scratch;	// Encoding of the frame being pushed
+	Chip8State cachedKeyframe;		// Decoded keyframe, the base of the deltas being pushed or popped
+	uint64_t cachedSerial = NO_FRAME;	// Serial it was decoded from (serials are never reused)
+	size_t head = 0;
+	size_t count = 0;
+	uint64_t firstSerial = 0;		// Frames get consecutive serials, this is the oldest one held
+	uint64_t newestKeyframe = NO_FRAME;	// Base of the next delta, NO_FRAME to start a new keyframe
+	unsigned int sinceKeyframe = 0;
+	unsigned int keyframeInterval;
+	size_t writeOffset = 0;
+	size_t bytesUsed = 0;
+
+	Entry& At(uint64_t serial) {
+		return entries[(head + (size_t)(serial - firstSerial)) % entries.size()];
+	}
+
+	void PopFront() {
+		bytesUsed -= entries[head].size;
+		head = (head + 1) % entries.size();
+		count--;
+		firstSerial++;
+		if (newestKeyframe != NO_FRAME && newestKeyframe < firstSerial) newestKeyframe = NO_FRAME;
+	}
+
+	// Drops the oldest frames until their deltas have no keyframe left to apply to
+	void DropOrphans() {
+		while (count > 0 && entries[head].keyframe < firstSerial) PopFront();
+	}
+
+	// Finds room for size bytes after the newest frame, wrapping to the start and evicting the oldest frames
+	size_t Reserve(size_t size) {
+		size_t offset = writeOffset;
+		if (offset + size > data.size()) {
+			while (count > 0 && entries[head].offset >= offset) PopFront(); // Left behind at the end by the wrap
+			offset = 0;
+		}
+		while (count > 0 && entries[head].offset < offset + size && entries[head].offset + entries[head].size > offset) PopFront();
+		DropOrphans();
+		return offset;
+	}
+
+	// The decoded keyframe with the given serial, which has to be held
+	const uint8_t* Keyframe(uint64_t serial) {
+		if (cachedSerial != serial) {
+			const Entry& entry = At(serial);
+			Decode(&data[entry.offset], entry.size, Zeros(), reinterpret_cast<uint8_t*>(&cachedKeyframe));
+			cachedSerial = serial;
+		}
+		return reinterpret_cast<const uint8_t*>(&cachedKeyframe);
+	}
+
+	// What keyframes are XORed against
+	static const uint8_t* Zeros() {
+		static const uint64_t zeros[STATE_WORDS] = {};
+		return reinterpret_cast<const uint8_t*>(zeros);
+	}
+
+	static uint8_t* PutVarint(uint8_t* out, size_t value) {
+		while (value >= 0x80) {
+			*out++ = (uint8_t)(value | 0x80);
+			value >>= 7;
+		}
+		*out++ = (uint8_t)value;
+		return out;
+	}
+
+	static size_t GetVarint(const uint8_t*& in) {
+		size_t value = 0;
+		for (unsigned int shift = 0;; shift += 7) {
+			uint8_t byte = *in++;
+			value |= (size_t)(byte & 0x7F) << shift;
+			if (byte < 0x80) return value;
+		}
+	}
+
+	static uint64_t Word(const uint8_t* bytes, size_t word) {
+		uint64_t value;
+		std::memcpy(&value, bytes + word * sizeof(uint64_t), sizeof(value));
+		return value;
+	}
+
+	// XORs state against base and run-length codes the result into out, returns the encoded size
+	static size_t Encode(const uint8_t* state, const uint8_t* base, uint8_t* out) {
+		uint8_t* start = out;
+		size_t word = 0;
+		while (word < STATE_WORDS) {
+			size_t same = word;
+			while (same < STATE_WORDS && Word(state, same) == Word(base, same)) same++;
+			size_t changed = same;
+			while (changed < STATE_WORDS && Word(state, changed) != Word(base, changed)) changed++;
+			if (same == STATE_WORDS) break; // Trailing unchanged words need no token
+
+			out = PutVarint(out, same - word);
+			out = PutVarint(out, changed - same);
+			for (size_t i = same; i < changed; i++) {
+				uint64_t delta = Word(state, i) ^ Word(base, i);
+				std::memcpy(out, &delta, sizeof(delta));
+				out += sizeof(delta);
+			}
+			word = changed;
+		}
+		return (size_t)(out - start);
+	}
+
+	static void Decode(const uint8_t* in, size_t size, const uint8_t* base, uint8_t* state) {
+		std::memcpy(state, base, sizeof(Chip8State));
+		const uint8_t* end = in + size;
+		size_t word = 0;
+		while (in < end) {
+			word += GetVarint(in);
+			size_t changed = GetVarint(in);
+			for (size_t i = 0; i < changed; i++, word++) {
+				uint64_t delta;
+				std::memcpy(&delta, in, sizeof(delta));
+				in += sizeof(delta);
+				uint64_t value = Word(state, word) ^ delta;
+				std::memcpy(state + word * sizeof(uint64_t), &value, sizeof(value));
+			}
+		}
+	}
+};
@@ -0,0 +1,157 @@
+/*
+Chip-8 Emulator -- timeline tracing
+Scoped events (a TraceScope around each phase of a frame or job slice) recorded per thread and
+written out in the Chrome trace event format, which chrome://tracing, Perfetto
+(ui.perfetto.dev) and speedscope all load, to see where the wall time of every frame went.
+
+Recording takes no lock: every thread writes only to its own ring, which keeps the last
+TRACE_RING_EVENTS events, and publishes each one with a release store of the ring's head.
+The registry of rings is only locked once per thread, the first time it records, and a thread
+that never records (tracing off) has no ring. While tracing is off a scope costs a relaxed load.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+constexpr size_t TRACE_RING_EVENTS = 1 << 18;	// Per thread (6 MB), about 10 minutes of frames in the frontend
+
+class Trace {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	// Starts recording, timestamps count from here
+	static void Start() {
+		origin = Clock::now();
+		enabled.store(true, std::memory_order_relaxed);
+	}
+
+	static void Stop() {
+		enabled.store(false, std::memory_order_relaxed);
+	}
+
+	static bool Enabled() {
+		return enabled.load(std::memory_order_relaxed);
+	}
+
+	// Names the calling thread in the trace ("main", "worker 3", ...), kept for its ring until it records
+	static void NameThread(const std::string& name) {
+		Local& local = ThisLocal();
+		if (local.name == name) return;
+		local.name = name;
+		if (local.ring != nullptr) local.ring->name = name;
+	}
+
+	// Appends a complete event to the calling thread's ring, overwriting its oldest one when full
+	static void Record(const char* name, Clock::time_point start, Clock::time_point end) {
+		Ring& ring = ThisThread();
+		uint64_t head = ring.head.load(std::memory_order_relaxed);
+		ring.events[head % TRACE_RING_EVENTS] = Event{ name, Nanoseconds(start - origin), Nanoseconds(end - start) };
+		ring.head.store(head + 1, std::memory_order_release);
+	}
+
+	// Writes the events of every thread that recorded as a Chrome trace (JSON object format, times in
+	// microseconds). Meant for when the traced threads are done: a thread still recording may overwrite
+	// its oldest events while they are being written.
+	static bool WriteJson(std::ostream& out) {
+		std::lock_guard<std::mutex> lock(registryMutex);
+		out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+			<< "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"chip8\"}}";
+		char line[256];
+		for (const std::unique_ptr<Ring>& ring : rings) {
+			out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << ring->id << ",\"args\":{\"name\":\""
+				<< Escaped(ring->name.empty() ? "thread " + std::to_string(ring->id) : ring->name) << "\"}}";
+			uint64_t head = ring->head.load(std::memory_order_acquire);
+			for (uint64_t i = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0; i < head; i++) {
+				const Event& event = ring->events[i % TRACE_RING_EVENTS];
+				std::snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+					Escaped(event.name).c_str(), ring->id, event.start / 1e3, event.duration / 1e3);
+				out << line;
+			}
+		}
+		out << "\n]}\n";
+		return (bool)out.flush();
+	}
+
+private:
+	struct Event {
+		const char* name;	// String literal
+		int64_t start;		// Since Start(), in nanoseconds
+		int64_t duration;
+	};
+
+	struct Ring {
+		std::vector<Event> events = std::vector<Event>(TRACE_RING_EVENTS);
+		std::atomic<uint64_t> head{ 0 };	// Events ever recorded, the newest is at head - 1
+		std::string name;
+		unsigned int id = 0;
+	};
+
+	static inline std::atomic<bool> enabled{ false };
+	static inline Clock::time_point origin{};
+	static inline std::mutex registryMutex;
+	static inline std::vector<std::unique_ptr<Ring>> rings;	// Outlive their threads, so a pool's events are still there to write
+
+	struct Local {
+		Ring* ring = nullptr;	// Allocated by the thread's first event
+		std::string name;
+	};
+
+	static Local& ThisLocal() {
+		thread_local Local local;
+		return local;
+	}
+
+	static Ring& ThisThread() {
+		Local& local = ThisLocal();
+		if (local.ring == nullptr) {
+			std::lock_guard<std::mutex> lock(registryMutex);
+			rings.push_back(std::make_unique<Ring>());
+			local.ring = rings.back().get();
+			local.ring->id = (unsigned int)rings.size();
+			local.ring->name = local.name;
+		}
+		return *local.ring;
+	}
+
+	static int64_t Nanoseconds(Clock::duration duration) {
+		return (int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+	}
+
+	static std::string Escaped(const std::string& text) {
+		std::string escaped;
+		for (char c : text) {
+			if (c == '"' || c == '\\') escaped += '\\';
+			if ((unsigned char)c >= 0x20) escaped += c;
+		}
+		return escaped;
+	}
+};
+
+// Records the time from its construction to the end of its scope as one event, nothing while tracing is off
+class TraceScope {
+public:
+	explicit TraceScope(const char* name) : name(Trace::Enabled() ? name : nullptr) {
+		if (this->name != nullptr) start = Trace::Clock::now();
+	}
+
+	~TraceScope() {
+		if (name != nullptr) Trace::Record(name, start, Trace::Clock::now());
+	}
+
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+	const char* name;
+	Trace::Clock::time_point start;
+};
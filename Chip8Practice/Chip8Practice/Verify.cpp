@@ -0,0 +1,762 @@
+/*
+Chip-8 Emulator -- verification and benchmarks
+Checks every core, the lock-step engine, save states, the rewind buffer, movies and idle loop
+skipping against the reference interpreter (Chip8::Cycle()), or with --bench measures them,
+on a ROM or on a built-in program. No SDL, so it runs wherever the core builds; the CMake
+build registers the verification with ctest.
+*/
+
+#include <iostream>
+#include <string>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include "Chip8.h"
+#include "Display.h"
+#include "HeadlessRun.h"
+#include "Lockstep.h"
+#include "Movie.h"
+#include "Rewind.h"
+
+namespace {
+
+// The RND implementation the emulator used to ship with, kept to benchmark against
+class LegacyRandom : public RandomSource {
+public:
+	uint8_t NextByte() override {
+		std::random_device rd;
+		std::mt19937 gen(rd());
+		std::uniform_int_distribution<> dist(0, 255);
+		return (uint8_t)dist(gen);
+	}
+};
+
+volatile unsigned int benchSink; // Keeps benchmark results observable to the optimizer
+
+// Measures how many Cxkk instructions per second the given RND source sustains
+double benchRnd(Chip8& chip8, RandomSource* source, int iterations) {
+	chip8.SetRandomSource(source);
+	chip8.opcode = 0xC0FFu; // RND V0, 0xFF
+	unsigned int sink = 0;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < iterations; i++) {
+		chip8.OP_Cxkk();
+		sink += chip8.registers[0];
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	chip8.SetRandomSource(nullptr);
+
+	benchSink = sink;
+	double seconds = std::chrono::duration<double>(end - start).count();
+	return iterations / seconds;
+}
+
+// Fixed CHIP-8 program for the interpreter benchmark: an ALU loop with a call, a skip and RND
+constexpr uint8_t BENCH_ROM[] = {
+	0x60, 0x00,	// 200: LD V0, 0
+	0x61, 0x01,	// 202: LD V1, 1
+	0x80, 0x14,	// 204: ADD V0, V1
+	0x72, 0x01,	// 206: ADD V2, 1
+	0x82, 0x13,	// 208: XOR V2, V1
+	0xA3, 0x00,	// 20A: LD I, 0x300
+	0xF2, 0x1E,	// 20C: ADD I, V2
+	0x30, 0x00,	// 20E: SE V0, 0
+	0x12, 0x04,	// 210: JP 0x204
+	0x22, 0x16,	// 212: CALL 0x216
+	0x12, 0x00,	// 214: JP 0x200
+	0xC3, 0xFF,	// 216: RND V3, 0xFF
+	0x00, 0xEE	// 218: RET
+};
+
+// Loads the ROM, or BENCH_ROM when there is none
+void loadProgram(const char* romFilename, Chip8& chip8) {
+	if (romFilename != nullptr) {
+		loadROM(romFilename, chip8);
+	}
+	else {
+		std::copy(std::begin(BENCH_ROM), std::end(BENCH_ROM), &chip8.memory[START_ADDRESS]);
+	}
+}
+
+// Runs the ROM (or BENCH_ROM) for the given number of cycles on one core and reports instructions per second
+void benchBackend(Backend backend, const char* romFilename, uint64_t cycles) {
+	Chip8* chip8 = new Chip8(1);
+	loadProgram(romFilename, *chip8);
+	chip8->backend = backend;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	chip8->Run(cycles);
+	auto end = std::chrono::high_resolution_clock::now();
+
+	double seconds = std::chrono::duration<double>(end - start).count();
+	std::cout << "Backend " << backendName(backend) << ": " << cycles / seconds / 1e6 << " M instructions/s"
+		<< " (state " << std::hex << hashState(*chip8) << std::dec << ")" << std::endl;
+
+	delete chip8;
+}
+
+// Same as benchBackend on the switch core with an OpcodeProfile, then a PcProfile, filled in, and prints them
+void benchProfiles(const char* romFilename, uint64_t cycles) {
+	for (bool byAddress : { false, true }) {
+		Chip8* chip8 = new Chip8(1);
+		loadProgram(romFilename, *chip8);
+		OpcodeProfile* opcodeProfile = byAddress ? nullptr : new OpcodeProfile();
+		PcProfile* pcProfile = byAddress ? new PcProfile() : nullptr;
+		chip8->opcodeProfile = opcodeProfile;
+		chip8->pcProfile = pcProfile;
+
+		auto start = std::chrono::high_resolution_clock::now();
+		chip8->Run(cycles);
+		auto end = std::chrono::high_resolution_clock::now();
+
+		double seconds = std::chrono::duration<double>(end - start).count();
+		std::cout << "Backend switch, " << (byAddress ? "PC" : "opcode") << " profile: " << cycles / seconds / 1e6 << " M instructions/s"
+			<< " (state " << std::hex << hashState(*chip8) << std::dec << ")" << std::endl;
+		if (opcodeProfile != nullptr) printOpcodeProfile(*opcodeProfile, std::cout);
+		if (pcProfile != nullptr) pcProfile->PrintFlat(std::cout, chip8->memory);
+
+		delete opcodeProfile;
+		delete pcProfile;
+		delete chip8;
+	}
+}
+
+// Runs a core in lockstep with the reference Cycle() interpreter, comparing the whole machine after every chunk.
+// Profiled runs the profiling core instead (both profiles on) and also checks that they counted every instruction.
+bool verifyBackend(Backend backend, const char* romFilename, uint64_t cycles, bool profiled = false) {
+	Chip8* reference = new Chip8(1);
+	Chip8* candidate = new Chip8(1);
+	loadProgram(romFilename, *reference);
+	loadProgram(romFilename, *candidate);
+	candidate->backend = backend;
+	OpcodeProfile* profile = profiled ? new OpcodeProfile() : nullptr;
+	PcProfile* pcProfile = profiled ? new PcProfile() : nullptr;
+	candidate->opcodeProfile = profile;
+	candidate->pcProfile = pcProfile;
+
+	uint32_t chunkSeed = 1;
+	uint64_t done = 0;
+	bool same = true;
+	while (done < cycles && same) {
+		chunkSeed = chunkSeed * 1103515245u + 12345u;
+		uint64_t chunk = std::min<uint64_t>(1 + (chunkSeed >> 16u) % 64u, cycles - done); // Odd sizes split blocks at every position
+		for (uint64_t i = 0; i < chunk; i++) reference->Cycle();
+		candidate->Run(chunk);
+		reference->TickTimers(); // Every chunk stands for a frame, so Fx07 sees the timers move
+		candidate->TickTimers();
+		done += chunk;
+		same = sameState(*reference, *candidate);
+	}
+
+	if (profile != nullptr) {
+		uint64_t counted = 0, countedByAddress = 0;
+		for (uint64_t count : profile->counts) counted += count;
+		for (uint16_t address = 0; address < 4096; address++) countedByAddress += pcProfile->Cycles(address);
+		same = same && counted == done && countedByAddress == done;
+		delete profile;
+		delete pcProfile;
+	}
+
+	const char* name = profiled ? "profiled" : backendName(backend);
+	if (same) {
+		std::cout << "Backend " << name << ": OK, " << done << " cycles in lockstep" << std::endl;
+	}
+	else {
+		std::cout << "Backend " << name << ": diverged within the cycles " << done << std::hex
+			<< ", pc " << candidate->pc << " (reference " << reference->pc << ")" << std::dec << std::endl;
+	}
+
+	delete reference;
+	delete candidate;
+	return same;
+}
+
+// Runs frames of DEFAULT_INSTRUCTIONS_PER_FRAME on a machine, timers included
+void runFrames(Chip8& chip8, uint64_t frames) {
+	for (uint64_t frame = 0; frame < frames; frame++) chip8.RunFrame(DEFAULT_INSTRUCTIONS_PER_FRAME);
+}
+
+// Snapshots a machine part way through a run, restores the binary form into a new machine and the in-memory
+// form over the original once it has moved on, and checks that they all carry on exactly alike
+bool verifySaveState(const char* romFilename, uint64_t frames) {
+	Chip8* original = new Chip8(1);
+	Chip8* restored = new Chip8(2); // Another seed, the snapshot has to bring the RND state along
+	loadProgram(romFilename, *original);
+	original->backend = Backend::Predecoded;
+	restored->backend = Backend::Jit;
+
+	runFrames(*original, frames);
+	Chip8State snapshot;
+	original->SaveState(snapshot);
+	std::vector<uint8_t> binary = original->SaveState();
+	bool same = restored->LoadState(binary.data(), binary.size());
+	same = same && !restored->LoadState(binary.data(), binary.size() - 1); // Truncated snapshots are refused
+
+	runFrames(*original, frames);
+	runFrames(*restored, frames);
+	same = same && sameState(*original, *restored) && original->rng.state == restored->rng.state;
+	uint64_t finalHash = hashState(*original);
+
+	original->LoadState(snapshot);
+	runFrames(*original, frames);
+	same = same && sameState(*original, *restored) && hashState(*original) == finalHash;
+
+	if (same) {
+		std::cout << "Save state: OK, " << binary.size() << " bytes" << std::endl;
+	}
+	else {
+		std::cout << "Save state: restored machine diverged" << std::hex << ", pc " << restored->pc
+			<< " (original " << original->pc << ")" << std::dec << std::endl;
+	}
+
+	delete original;
+	delete restored;
+	return same;
+}
+
+// Time per snapshot, in-memory save and restore against the binary form
+void benchSaveState(const char* romFilename, unsigned int count) {
+	Chip8* chip8 = new Chip8(1);
+	loadProgram(romFilename, *chip8);
+	chip8->backend = Backend::Predecoded;
+	runFrames(*chip8, 60);
+	Chip8State* snapshot = new Chip8State();
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (unsigned int i = 0; i < count; i++) {
+		chip8->SaveState(*snapshot);
+		chip8->LoadState(*snapshot);
+	}
+	double memorySeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	size_t bytes = 0;
+	start = std::chrono::high_resolution_clock::now();
+	for (unsigned int i = 0; i < count; i++) {
+		std::vector<uint8_t> binary = chip8->SaveState();
+		bytes = binary.size();
+		chip8->LoadState(binary.data(), binary.size());
+	}
+	double binarySeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	std::cout << "Save + load state: in memory " << memorySeconds / count * 1e9 << " ns (" << sizeof(Chip8State) << " bytes), binary "
+		<< binarySeconds / count * 1e9 << " ns (" << bytes << " bytes)" << std::endl;
+	delete snapshot;
+	delete chip8;
+}
+
+// Records frames into a rewind buffer, rewinds all the way back and checks every frame against its hash
+bool verifyRewind(const char* romFilename, uint64_t frames) {
+	Chip8* chip8 = new Chip8(1);
+	loadProgram(romFilename, *chip8);
+	chip8->backend = Backend::Predecoded;
+	RewindBuffer* rewind = new RewindBuffer(frames, REWIND_BUDGET);
+	std::vector<uint64_t> hashes;
+
+	for (uint64_t frame = 0; frame < frames; frame++) {
+		rewind->Push(*chip8);
+		hashes.push_back(hashState(*chip8));
+		chip8->RunFrame(DEFAULT_INSTRUCTIONS_PER_FRAME);
+	}
+
+	// Back half way, forward again (deltas against a new keyframe) and all the way back
+	Chip8State state;
+	bool same = true;
+	for (uint64_t frame = frames; frame-- > frames / 2;) {
+		same = same && rewind->Pop(state);
+		chip8->LoadState(state);
+		same = same && hashState(*chip8) == hashes[frame];
+	}
+	for (uint64_t frame = frames / 2; frame < frames; frame++) {
+		rewind->Push(*chip8);
+		chip8->RunFrame(DEFAULT_INSTRUCTIONS_PER_FRAME);
+	}
+	uint64_t kept = rewind->Frames();
+	for (uint64_t frame = frames; frame-- > frames - kept;) {
+		same = same && rewind->Pop(state);
+		chip8->LoadState(state);
+		same = same && hashState(*chip8) == hashes[frame];
+	}
+	same = same && !rewind->Pop(state);
+
+	if (same) {
+		std::cout << "Rewind: OK, " << kept << " frames" << std::endl;
+	}
+	else {
+		std::cout << "Rewind: restored frame differs from the recorded one" << std::endl;
+	}
+
+	delete rewind;
+	delete chip8;
+	return same;
+}
+
+// Cost of recording one frame, and how much the default rewind window takes
+void benchRewind(const char* romFilename) {
+	const unsigned int frames = REWIND_SECONDS * FRAME_RATE;
+	Chip8* chip8 = new Chip8(1);
+	loadProgram(romFilename, *chip8);
+	chip8->backend = Backend::Predecoded;
+	RewindBuffer* rewind = new RewindBuffer(frames, REWIND_BUDGET);
+
+	double seconds = 0;
+	for (unsigned int frame = 0; frame < 4 * frames; frame++) {
+		auto start = std::chrono::high_resolution_clock::now();
+		rewind->Push(*chip8);
+		seconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		chip8->RunFrame(DEFAULT_INSTRUCTIONS_PER_FRAME);
+	}
+
+	std::cout << "Rewind: " << seconds / (4 * frames) * 1e9 << " ns per frame, " << rewind->Frames() << " frames in "
+		<< rewind->BytesUsed() << " bytes (" << rewind->Capacity() << " reserved)" << std::endl;
+	delete rewind;
+	delete chip8;
+}
+
+// Records a run with pseudo-random key events the way the frontend does, replays the movie on a fresh
+// machine through runScripted() and checks that it ends in the recorded state, then seeks to frames
+// all over the movie and checks each against the state recorded there
+bool verifyMovie(const char* romFilename, uint64_t frames) {
+	const char* movieFilename = "chip8-verify.c8m";
+	Chip8* recorded = new Chip8(7);
+	Chip8* replayed = new Chip8(8);
+	loadProgram(romFilename, *recorded);
+	loadProgram(romFilename, *replayed);
+	recorded->backend = Backend::Predecoded;
+	replayed->backend = Backend::Jit;
+
+	MovieWriter* recorder = new MovieWriter();
+	bool same = recorder->Open(movieFilename, MovieHeader{ DEFAULT_INSTRUCTIONS_PER_FRAME, 7, hashProgram(*recorded), 100 });
+	std::vector<uint64_t> hashes;
+	uint32_t eventSeed = 1;
+	for (uint64_t frame = 0; frame < frames; frame++) {
+		hashes.push_back(hashState(*recorded));
+		recorder->BeginFrame(*recorded, frame);
+		eventSeed = eventSeed * 1103515245u + 12345u;
+		for (unsigned int event = 0; event < ((eventSeed >> 16u) & 3u); event++) { // Sometimes several keys in one frame
+			uint8_t key = (eventSeed >> (4u + 5u * event)) & 0xFu;
+			bool pressed = (eventSeed >> (8u + 5u * event)) & 1u;
+			recorded->KeyEvent(key, pressed);
+			recorder->Record(frame, key, pressed);
+		}
+		recorded->RunFrame(DEFAULT_INSTRUCTIONS_PER_FRAME);
+	}
+	same = recorder->Close(frames, hashState(*recorded)) && same;
+	delete recorder;
+
+	Movie movie;
+	std::string error;
+	same = same && loadMovie(movieFilename, movie, error) && movie.complete && movie.header.frames == frames;
+	replayed->Seed(movie.header.seed);
+	RunLimits limits;
+	limits.frames = movie.header.frames;
+	limits.instructionsPerFrame = movie.header.instructionsPerFrame;
+	runScripted(*replayed, movie.events, limits);
+	same = same && hashState(*replayed) == movie.header.finalStateHash && sameState(*recorded, *replayed);
+
+	MovieReader* reader = new MovieReader();
+	same = same && reader->Open(movieFilename, error);
+	double seekSeconds = 0;
+	unsigned int seeks = 0;
+	for (uint64_t target = frames - 1; same && target > 0; target = target * 5 / 7, seeks++) {
+		Chip8* seeked = new Chip8(9);
+		auto start = std::chrono::high_resolution_clock::now();
+		same = reader->Seek(*seeked, target) && hashState(*seeked) == hashes[target];
+		seekSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		delete seeked;
+	}
+	delete reader;
+	std::remove(movieFilename);
+
+	if (same) {
+		std::cout << "Movie: OK, " << movie.events.size() << " events, " << seeks << " seeks averaging "
+			<< seekSeconds / seeks * 1e6 << " us" << std::endl;
+	}
+	else {
+		std::cout << "Movie: replay diverged from the recording" << (error.empty() ? "" : ", ") << error << std::endl;
+	}
+
+	delete recorded;
+	delete replayed;
+	return same;
+}
+
+// Fixed CHIP-8 program for the idle loop checks: waits on the delay timer, waits for key 5 to be pressed
+// and released, draws a digit and starts over, then halts on a jump to itself after 8 rounds
+constexpr uint8_t IDLE_ROM[] = {
+	0x6A, 0x00,	// 200: LD VA, 0
+	0x60, 0x1E,	// 202: LD V0, 30
+	0xF0, 0x15,	// 204: LD DT, V0
+	0xF1, 0x07,	// 206: LD V1, DT
+	0x31, 0x00,	// 208: SE V1, 0
+	0x12, 0x06,	// 20A: JP 0x206
+	0x7A, 0x01,	// 20C: ADD VA, 1
+	0xFA, 0x29,	// 20E: LD F, VA
+	0x6B, 0x08,	// 210: LD VB, 8
+	0xDB, 0xB5,	// 212: DRW VB, VB, 5
+	0x65, 0x05,	// 214: LD V5, 5
+	0xE5, 0x9E,	// 216: SKP V5
+	0x12, 0x16,	// 218: JP 0x216
+	0xE5, 0xA1,	// 21A: SKNP V5
+	0x12, 0x1A,	// 21C: JP 0x21A
+	0x3A, 0x08,	// 21E: SE VA, 8
+	0x12, 0x02,	// 220: JP 0x202
+	0x12, 0x22	// 222: JP 0x222
+};
+
+// Loads the ROM, or IDLE_ROM when there is none, and makes up key 5 presses and releases for it
+void loadIdleProgram(const char* romFilename, Chip8& chip8, std::vector<InputEvent>& events, uint64_t frames) {
+	if (romFilename != nullptr) {
+		loadROM(romFilename, chip8);
+	}
+	else {
+		std::copy(std::begin(IDLE_ROM), std::end(IDLE_ROM), &chip8.memory[START_ADDRESS]);
+	}
+	events.clear();
+	for (uint64_t frame = 45; frame + 3 < frames; frame += 97 + frame % 13) {
+		events.push_back(InputEvent{ frame, 5, true });
+		events.push_back(InputEvent{ frame + 3, 5, false });
+	}
+}
+
+// Runs a ROM (IDLE_ROM by default) through runScripted() with idle loops skipped, in resumed chunks of frames,
+// against a machine stepped with Cycle() one instruction at a time, and compares them after every chunk
+bool verifyIdle(const char* romFilename, uint64_t frames, unsigned int instructionsPerFrame) {
+	Chip8* reference = new Chip8(1);
+	Chip8* candidate = new Chip8(1);
+	std::vector<InputEvent> events;
+	loadIdleProgram(romFilename, *reference, events, frames);
+	loadIdleProgram(romFilename, *candidate, events, frames);
+	candidate->backend = Backend::Jit;
+
+	uint64_t frame = 0, referenceCycles = 0, candidateCycles = 0, skippedFrames = 0;
+	size_t nextEvent = 0, referenceEvent = 0;
+	uint32_t chunkSeed = 1;
+	bool same = true;
+	while (frame < frames && same) {
+		chunkSeed = chunkSeed * 1103515245u + 12345u;
+		RunLimits limits;
+		limits.frames = std::min<uint64_t>(1 + (chunkSeed >> 16u) % 400u, frames - frame);
+		limits.instructionsPerFrame = instructionsPerFrame;
+		uint64_t end = frame + limits.frames;
+		RunResult result = runScripted(*candidate, events, limits, frame, nextEvent);
+		candidateCycles += result.cycles;
+		skippedFrames += result.skippedFrames;
+
+		for (uint64_t step = end - limits.frames; step < end; step++) {
+			for (; referenceEvent < events.size() && events[referenceEvent].frame <= step; referenceEvent++) {
+				reference->KeyEvent(events[referenceEvent].key, events[referenceEvent].pressed);
+			}
+			for (unsigned int i = 0; i < instructionsPerFrame && !reference->waitingForKey; i++, referenceCycles++) reference->Cycle();
+			reference->TickTimers();
+		}
+		same = frame == end && candidateCycles == referenceCycles && sameState(*reference, *candidate);
+	}
+
+	if (same) {
+		std::cout << "Idle loops at " << instructionsPerFrame << " instructions per frame: OK, " << frames << " frames, "
+			<< candidate->idleCyclesSkipped * 100.0 / std::max<uint64_t>(candidateCycles, 1) << "% of the cycles and "
+			<< skippedFrames << " frames skipped" << std::endl;
+	}
+	else {
+		std::cout << "Idle loops at " << instructionsPerFrame << " instructions per frame: diverged before frame " << frame << std::hex
+			<< ", pc " << candidate->pc << " (reference " << reference->pc << ")" << std::dec << std::endl;
+	}
+
+	delete reference;
+	delete candidate;
+	return same;
+}
+
+// Headless frames per second on a ROM (IDLE_ROM by default) with and without idle loop skipping
+void benchIdle(const char* romFilename, uint64_t frames) {
+	for (bool skip : { false, true }) {
+		Chip8* chip8 = new Chip8(1);
+		std::vector<InputEvent> events;
+		loadIdleProgram(romFilename, *chip8, events, frames);
+		chip8->backend = Backend::Predecoded;
+		chip8->skipIdleLoops = skip;
+		RunLimits limits;
+		limits.frames = frames;
+
+		auto start = std::chrono::high_resolution_clock::now();
+		runScripted(*chip8, events, limits);
+		double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		std::cout << "Idle loops " << (skip ? "skipped" : "stepped") << ": " << frames / seconds / 1e6 << " M frames/s"
+			<< " (state " << std::hex << hashState(*chip8) << std::dec << ")" << std::endl;
+		delete chip8;
+	}
+}
+
+// Lanes of the lock-step engine in the benchmark and the verification
+constexpr unsigned int LOCKSTEP_LANES = 16;
+
+// Loads the ROM (or BENCH_ROM) into every lane, through a scalar machine so both load the same bytes
+void loadLockstep(const char* romFilename, LockstepChip8<LOCKSTEP_LANES>& lockstep) {
+	Chip8* chip8 = new Chip8(1);
+	loadProgram(romFilename, *chip8);
+	lockstep.LoadROM(&chip8->memory[START_ADDRESS], sizeof(chip8->memory) - START_ADDRESS);
+	delete chip8;
+}
+
+// Lanes split by RND between two loops 0x100 apart (0x210 and 0x310, the same low pc byte) that run
+// different code, then meet again at 0x200: lanes at different pcs must never run as one group
+void loadSplitProgram(Chip8& chip8) {
+	const uint16_t program[][2] = {
+		{ 0x200, 0x6100 },	// LD V1, 0
+		{ 0x202, 0xC001 },	// RND V0, 1
+		{ 0x204, 0x3000 },	// SE V0, 0
+		{ 0x206, 0x1310 },	// JP 0x310
+		{ 0x208, 0x1210 },	// JP 0x210
+		{ 0x210, 0x7101 },	// ADD V1, 1
+		{ 0x212, 0x3108 },	// SE V1, 8
+		{ 0x214, 0x1210 },	// JP 0x210
+		{ 0x216, 0x1200 },	// JP 0x200
+		{ 0x310, 0x7102 },	// ADD V1, 2
+		{ 0x312, 0x3108 },	// SE V1, 8
+		{ 0x314, 0x1310 },	// JP 0x310
+		{ 0x316, 0x1200 }	// JP 0x200
+	};
+	for (const auto& instruction : program) {
+		chip8.memory[instruction[0]] = (uint8_t)(instruction[1] >> 8u);
+		chip8.memory[instruction[0] + 1] = (uint8_t)instruction[1];
+	}
+	chip8.InvalidateCode(START_ADDRESS, sizeof(chip8.memory) - START_ADDRESS);
+}
+
+// Runs the lock-step engine against one scalar machine per lane (same seeds, same random key presses),
+// comparing every lane with its machine after every chunk. Split runs loadSplitProgram() instead of the ROM.
+bool verifyLockstep(const char* romFilename, uint64_t cycles, bool split = false) {
+	Chip8* program = new Chip8(1);
+	if (split) loadSplitProgram(*program);
+	else loadProgram(romFilename, *program);
+	const uint8_t* rom = &program->memory[START_ADDRESS];
+	const size_t romSize = sizeof(program->memory) - START_ADDRESS;
+
+	uint64_t seeds[LOCKSTEP_LANES];
+	std::vector<Chip8*> references;
+	for (unsigned int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+		seeds[lane] = lane + 1;
+		references.push_back(new Chip8(seeds[lane]));
+		loadROMData(*references.back(), rom, romSize);
+	}
+	auto* lockstep = new LockstepChip8<LOCKSTEP_LANES>(seeds);
+	lockstep->LoadROM(rom, romSize);
+	Chip8* extracted = new Chip8(0);
+
+	uint32_t chunkSeed = 1;
+	uint64_t done = 0;
+	bool same = true;
+	unsigned int badLane = 0;
+	while (done < cycles && same) {
+		chunkSeed = chunkSeed * 1103515245u + 12345u;
+		uint64_t chunk = std::min<uint64_t>(1 + (chunkSeed >> 16u) % 64u, cycles - done);
+		unsigned int lane = (chunkSeed >> 8u) % LOCKSTEP_LANES; // One lane gets a key event, so the lanes drift apart
+		uint8_t key = (chunkSeed >> 4u) & 0xFu;
+		bool pressed = (chunkSeed >> 3u) & 1u;
+		references[lane]->KeyEvent(key, pressed);
+		lockstep->KeyEvent(lane, key, pressed);
+
+		for (Chip8* reference : references) reference->Run(chunk);
+		lockstep->Run(chunk);
+		for (Chip8* reference : references) reference->TickTimers();
+		lockstep->TickTimers();
+		done += chunk;
+
+		for (badLane = 0; badLane < LOCKSTEP_LANES && same; badLane++) {
+			lockstep->Extract(badLane, *extracted);
+			same = sameState(*references[badLane], *extracted);
+		}
+	}
+
+	const char* name = split ? " (lanes split 0x100 apart)" : "";
+	if (same) {
+		std::cout << "Lockstep x" << LOCKSTEP_LANES << name << ": OK, " << done << " cycles, " << lockstep->ScalarLanes()
+			<< " lanes handed over" << std::endl;
+	}
+	else {
+		std::cout << "Lockstep x" << LOCKSTEP_LANES << name << ": lane " << badLane - 1 << " diverged within the cycles " << done
+			<< std::hex << ", pc " << extracted->pc << " (reference " << references[badLane - 1]->pc << ")" << std::dec << std::endl;
+	}
+
+	for (Chip8* reference : references) delete reference;
+	delete lockstep;
+	delete extracted;
+	delete program;
+	return same;
+}
+
+// Draws every hex digit with Fx29 and Dxy5 on each core and on the lock-step engine and checks the rows against
+// the font, which comparing the cores with Cycle() cannot catch when they all share a mistake
+bool verifyFont() {
+	const char* failed = nullptr;
+	unsigned int failedDigit = 0;
+	for (unsigned int digit = 0; digit < 16 && failed == nullptr; digit++) {
+		const uint8_t rom[] = {
+			0x60, (uint8_t)digit,	// 200: LD V0, digit
+			0xF0, 0x29,				// 202: LD F, V0
+			0x61, 0x00,				// 204: LD V1, 0
+			0xD1, 0x15,				// 206: DRW V1, V1, 5
+			0x12, 0x08				// 208: JP 0x208
+		};
+		auto drewGlyph = [digit](const Chip8& chip8) {
+			bool same = true;
+			for (unsigned int row = 0; row < 5; row++) same = same && chip8.screen[row] == (uint64_t)fontset[digit * 5 + row] << 56u;
+			return same;
+		};
+
+		for (Backend backend : { Backend::Table, Backend::Switch, Backend::Threaded, Backend::Predecoded, Backend::Blocks, Backend::Jit }) {
+			Chip8* chip8 = new Chip8(1);
+			loadROMData(*chip8, rom, sizeof(rom));
+			chip8->backend = backend;
+			chip8->Run(16);
+			if (failed == nullptr && !drewGlyph(*chip8)) failed = backendName(backend);
+			delete chip8;
+		}
+
+		uint64_t seeds[LOCKSTEP_LANES]{};
+		auto* lockstep = new LockstepChip8<LOCKSTEP_LANES>(seeds);
+		lockstep->LoadROM(rom, sizeof(rom));
+		lockstep->Run(16);
+		Chip8* extracted = new Chip8(0);
+		for (unsigned int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+			lockstep->Extract(lane, *extracted);
+			if (failed == nullptr && !drewGlyph(*extracted)) failed = "lockstep";
+		}
+		delete extracted;
+		delete lockstep;
+		failedDigit = digit;
+	}
+
+	if (failed == nullptr) std::cout << "Font: OK, every digit on every core" << std::endl;
+	else std::cout << "Font: " << failed << " drew the wrong glyph for " << std::hex << failedDigit << std::dec << std::endl;
+	return failed == nullptr;
+}
+
+// Aggregate instructions per second of the lock-step engine against as many scalar machines run one after the other
+void benchLockstep(const char* romFilename, uint64_t cycles) {
+	uint64_t seeds[LOCKSTEP_LANES];
+	for (unsigned int lane = 0; lane < LOCKSTEP_LANES; lane++) seeds[lane] = lane + 1;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (unsigned int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+		Chip8* chip8 = new Chip8(seeds[lane]);
+		loadProgram(romFilename, *chip8);
+		chip8->backend = Backend::Predecoded;
+		chip8->Run(cycles);
+		delete chip8;
+	}
+	double scalarSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	auto* lockstep = new LockstepChip8<LOCKSTEP_LANES>(seeds);
+	loadLockstep(romFilename, *lockstep);
+	start = std::chrono::high_resolution_clock::now();
+	lockstep->Run(cycles);
+	double lockstepSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	double total = (double)cycles * LOCKSTEP_LANES;
+	std::cout << "Lockstep x" << LOCKSTEP_LANES << " (" << LOCKSTEP_VECTOR_ISA << " build): " << total / lockstepSeconds / 1e6 << " M instructions/s, "
+		<< LOCKSTEP_LANES << " predecoded machines " << total / scalarSeconds / 1e6 << " M instructions/s ("
+		<< (double)lockstep->Groups() / std::max<uint64_t>(lockstep->Steps(), 1) << " groups per step, "
+		<< lockstep->ScalarLanes() << " lanes handed over)" << std::endl;
+	delete lockstep;
+}
+
+// Expands a fixed pattern into a buffer of the same layout as the texture, returns pixels written per nanosecond
+template <void (*ExpandRow)(uint64_t, uint32_t*, const Palette&)>
+double benchExpand(unsigned int scale, unsigned int frames) {
+	uint64_t rows[SCREEN_HEIGHT];
+	for (unsigned int y = 0; y < SCREEN_HEIGHT; y++) {
+		rows[y] = 0x9E3779B97F4A7C15ull * (y + 1); // Mixed bits, no row alike
+	}
+	size_t pitch = SCREEN_WIDTH * scale;
+	std::vector<uint32_t> pixels(pitch * SCREEN_HEIGHT * scale);
+	Palette palette;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (unsigned int frame = 0; frame < frames; frame++) {
+		rows[frame % SCREEN_HEIGHT] ^= frame; // Keep every frame distinct
+		expandScreen<ExpandRow>(rows, pixels.data(), pitch, scale, palette);
+		benchSink = benchSink + pixels[frame % pixels.size()];
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	return (double)frames * pixels.size() / (seconds * 1e9);
+}
+
+void runBenchmarks(const char* romFilename) {
+	Chip8* chip8 = new Chip8(1);
+
+	LegacyRandom legacy;
+	double legacyRate = benchRnd(*chip8, &legacy, 200000);
+	double pcgRate = benchRnd(*chip8, nullptr, 50000000);
+	std::cout << "OP_Cxkk legacy (random_device + mt19937 per call): " << legacyRate / 1e6 << " M ops/s" << std::endl;
+	std::cout << "OP_Cxkk PCG32 (per-instance engine): " << pcgRate / 1e6 << " M ops/s" << std::endl;
+	std::cout << "Speedup: " << pcgRate / legacyRate << "x" << std::endl;
+
+	delete chip8;
+
+#if defined(CHIP8_EXPAND_AVX2)
+	const char* kernel = "AVX2";
+#elif defined(CHIP8_EXPAND_SSE2)
+	const char* kernel = "SSE2";
+#else
+	const char* kernel = "scalar";
+#endif
+	for (unsigned int scale : { 1u, 10u }) {
+		double scalarRate = benchExpand<expandRowScalar>(scale, 20000000u / (scale * scale));
+		double vectorRate = benchExpand<expandRow>(scale, 20000000u / (scale * scale));
+		std::cout << "Screen expansion x" << scale << ": scalar " << scalarRate << " pixels/ns, " << kernel << " " << vectorRate << " pixels/ns" << std::endl;
+	}
+
+	const uint64_t cycles = 50000000;
+	for (Backend backend : { Backend::Table, Backend::Switch, Backend::Threaded, Backend::Predecoded, Backend::Blocks, Backend::Jit }) {
+		benchBackend(backend, romFilename, cycles);
+	}
+	benchProfiles(romFilename, cycles);
+	benchLockstep(romFilename, cycles / 4);
+	benchSaveState(romFilename, 200000);
+	benchRewind(romFilename);
+	benchIdle(romFilename, 60 * 60 * FRAME_RATE);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+	const char* romFilename = nullptr; // BENCH_ROM (IDLE_ROM for the idle loop checks) when not given
+	bool bench = false;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--bench") {
+			bench = true;
+		}
+		else if (romFilename == nullptr && arg.rfind("--", 0) != 0) {
+			romFilename = argv[i];
+		}
+		else {
+			std::cerr << "Usage: " << argv[0] << " [--bench] [ROM]\n";
+			return -1;
+		}
+	}
+
+	if (bench) {
+		runBenchmarks(romFilename);
+		return 0;
+	}
+
+	bool allSame = true;
+	for (Backend candidate : { Backend::Switch, Backend::Threaded, Backend::Predecoded, Backend::Blocks, Backend::Jit }) {
+		allSame = verifyBackend(candidate, romFilename, 10000000) && allSame;
+	}
+	allSame = verifyBackend(Backend::Switch, romFilename, 10000000, true) && allSame;
+	allSame = verifyLockstep(romFilename, 2000000) && allSame;
+	allSame = verifyLockstep(nullptr, 200000, true) && allSame;
+	allSame = verifyFont() && allSame;
+	allSame = verifySaveState(romFilename, 6000) && allSame;
+	allSame = verifyRewind(romFilename, 1000) && allSame;
+	allSame = verifyMovie(romFilename, 6000) && allSame;
+	for (unsigned int instructionsPerFrame : { DEFAULT_INSTRUCTIONS_PER_FRAME, 1000u }) {
+		allSame = verifyIdle(romFilename, 6000, instructionsPerFrame) && allSame;
+	}
+	return allSame ? 0 : -1;
+}
@@ -0,0 +1,96 @@
+/*
+Chip-8 Emulator -- work-stealing scheduler for batch runs
+Every worker owns a deque of task ids: it takes work from the back of its own deque and,
+when that is empty, steals from the front of another worker's. A task runs one time slice
+at a time; an unfinished task goes back to the front of its worker's deque, behind the
+work already queued there, so long tasks cannot starve short ones and are the first to be
+stolen by idle workers.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkStealingPool {
+public:
+	explicit WorkStealingPool(unsigned int threadCount) : queues(threadCount > 0 ? threadCount : 1) {
+		for (auto& queue : queues) queue = std::make_unique<Queue>();
+	}
+
+	size_t ThreadCount() const {
+		return queues.size();
+	}
+
+	// Runs tasks 0..taskCount-1 to completion. runSlice(task, worker) runs one slice of a task
+	// and returns whether the task is finished; it is called from ThreadCount() threads at once
+	// but never for the same task twice at the same time.
+	template <typename RunSlice>
+	void Run(size_t taskCount, RunSlice runSlice) {
+		for (size_t task = 0; task < taskCount; task++) {
+			queues[task % queues.size()]->tasks.push_front(task); // Worker w starts with tasks w, w + n, ... in order
+		}
+		unfinished = taskCount;
+
+		std::vector<std::thread> workers;
+		for (size_t worker = 1; worker < queues.size(); worker++) {
+			workers.emplace_back([this, worker, &runSlice] { work(worker, runSlice); });
+		}
+		work(0, runSlice);
+		for (std::thread& thread : workers) thread.join();
+	}
+private:
+	struct Queue {
+		std::mutex lock;
+		std::deque<size_t> tasks;
+	};
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::atomic<size_t> unfinished{};
+
+	bool popOwn(size_t worker, size_t& task) {
+		Queue& queue = *queues[worker];
+		std::lock_guard<std::mutex> guard(queue.lock);
+		if (queue.tasks.empty()) return false;
+		task = queue.tasks.back();
+		queue.tasks.pop_back();
+		return true;
+	}
+
+	bool steal(size_t thief, size_t& task) {
+		for (size_t offset = 1; offset < queues.size(); offset++) {
+			Queue& queue = *queues[(thief + offset) % queues.size()];
+			std::lock_guard<std::mutex> guard(queue.lock);
+			if (queue.tasks.empty()) continue;
+			task = queue.tasks.front();
+			queue.tasks.pop_front();
+			return true;
+		}
+		return false;
+	}
+
+	template <typename RunSlice>
+	void work(size_t worker, RunSlice& runSlice) {
+		while (unfinished.load(std::memory_order_acquire) > 0) {
+			size_t task;
+			if (!popOwn(worker, task) && !steal(worker, task)) {
+				std::this_thread::yield(); // Everything left is running on other workers
+				continue;
+			}
+
+			if (runSlice(task, worker)) {
+				unfinished.fetch_sub(1, std::memory_order_acq_rel);
+			}
+			else {
+				Queue& queue = *queues[worker];
+				std::lock_guard<std::mutex> guard(queue.lock);
+				queue.tasks.push_front(task);
+			}
+		}
+	}
+};
@@ -6,482 +6,37 @@ Finished May 5th, 2025
 */
 
 #include <SDL3/SDL.h>
+#include <cstdio>
 #include <fstream>
 #include <iostream>
 #include <string>
 #include <random>
 #include <chrono>
-
-constexpr uint16_t START_ADDRESS = 0x200; // Starting address for Chip8 programs
-constexpr unsigned int FONTSET_SIZE = 80; // The font set size
-constexpr unsigned int FONTSET_START_ADDRESS = 0x50; // Start address for writing font data
-// The bytes representing each character in binary
-constexpr uint8_t fontset[FONTSET_SIZE] = {
-	0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-	0x20, 0x60, 0x20, 0x20, 0x70, // 1
-	0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-	0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-	0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-	0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-	0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-	0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-	0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-	0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-	0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-	0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-	0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-	0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-	0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-	0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-};
-
-constexpr uint8_t SCREEN_WIDTH = 64;
-constexpr uint8_t SCREEN_HEIGHT = 32;
-
-class Chip8 {
-public:
-	Chip8();
-	uint8_t registers[16]{};	// 16 8-bit registers (2^4)
-	
-	uint8_t memory[4096]{};		// 4K of memory (2^12)
-	uint16_t index{};			// 16-bit index register
-	uint16_t pc{};				// 16-bit program counter
-
-	uint16_t stack[16]{};		// 16 levels of stack (2^4)
-	uint8_t sp{};				// Stack pointer
-
-	uint8_t delay_timer{};		// 8-bit delay timer
-	uint8_t sound_timer{};		// 8-bit sound timer
-
-	uint8_t keypad[16]{};		// 16 keys (2^4)
-
-	uint32_t screen[64 * 32]{}; // 64x32 pixel screen (2^6 * 2^5)
-	uint16_t opcode{};			// Current opcode
-
-	uint8_t genRand() {
-		// 1) Create a random-device to seed our engine (non-deterministic)
-		std::random_device rd;
-		// 2) Choose a pseudo-random number engine
-		std::mt19937 gen(rd());
-		// 3) Define a distribution on the range you want, e.g., [0, 9]
-		std::uniform_int_distribution<> dist(0, 255);
-
-		// Generate some numbers 
-		uint8_t n = dist(gen);
-		return n;
-	}
-
-	// ************ INSTRUCTIONS ************
-	// CLS - 00E0 - Clear the display
-	void OP_00E0() {
-		unsigned int screenByteSize = sizeof(screen) / 4;
-		for (int i = 0; i < screenByteSize; i++) {
-			screen[i] = 0x00000000;
-		}
-	}
-
-	// RET - 00EE - Return from a subroutine
-	void OP_00EE() {
-		pc = stack[--sp];
-	}
-	
-	// JP addr - Jump to location nnn
-	void OP_1nnn() {
-		uint16_t address = opcode & 0x0FFFu;
-		pc = address;
-	}
-
-	// CALL addr - 2nnn - Call subroutine at nnn
-	void OP_2nnn() {
-		stack[sp++] = pc;
-		uint16_t jmpAddress = opcode & 0x0FFFu;
-		pc = jmpAddress;
-	}
-
-	// SE Vx, byte - 3xkk - Skip next instruction if Vx == kk
-	void OP_3xkk() {
-		uint8_t regX = (opcode & 0x0F00u) >> 8u; // Which register to compare
-		uint8_t valueToCompare = (opcode & 0x00FFu);
-
-		if (registers[regX] == valueToCompare) { // Values are equal, increment pc by 2
-			pc += 2;
-		}
-	}
-
-	// SNE Vx, byte - 4xkk - Skip next instruction if Vx != kk
-	void OP_4xkk() {
-		uint8_t regX = (opcode & 0x0F00u) >> 8u; // Which register to compare
-		uint8_t valueToCompare = (opcode & 0x00FFu);
-
-		if (registers[regX] != valueToCompare) // Values are not equal, increment pc by 2
-			pc += 2;
-	}
-
-	// SE Vx, Vy - 5xy0 - Skip next instruction if Vx == Vy
-	void OP_5xy0() {
-		uint8_t regX = (opcode & 0x0F00u) >> 8u; // Index of register X
-		uint8_t regY = (opcode & 0x00F0u) >> 4u; // Index of register Y
-
-		if (registers[regX] == registers[regY])
-			pc += 2;
-	}
-
-	// LD Vx, byte - 6xkk - The interpreter puts the value kk into register Vx
-	void OP_6xkk() {
-		uint8_t regX = (opcode & 0x0F00u) >> 8u;
-		uint8_t value = opcode & 0x00FFu;
-		registers[regX] = value;
-	}
-
-	// ADD Vx, byte - 7xkk - Adds the value kk to the value of register Vx, then stores the result in Vx
-	void OP_7xkk() {
-		uint8_t regX = (opcode & 0x0F00u) >> 8u;
-		uint8_t value = opcode & 0x00FFu;
-		registers[regX] += value;
-	}
-
-	// LD Vx, Vy - 8xy0 - Stores the value of register Vy in register Vx
-	void OP_8xy0() {
-		uint8_t regX = (opcode & 0x0F00u) >> 8u;
-		uint8_t regY = (opcode & 0x00F0u) >> 4u;
-		registers[regX] = registers[regY];
-	}
-
-	// OR Vx, Vy - 8xy1 - Performs a bitwise OR on the values of Vx and Vy, stored in Vx
-	void OP_8xy1() {
-		uint8_t regX = (opcode & 0x0F00u) >> 8u;
-		uint8_t regY = (opcode & 0x00F0u) >> 4u;
-		registers[regX] = registers[regX] | registers[regY];
-	}
-
-	// AND Vx, Vy - 8xy2 - Performs a bitwise AND on the values of Vx and Vy, stored in Vx
-	void OP_8xy2() {
-		uint8_t regX = (opcode & 0x0F00u) >> 8u;
-		uint8_t regY = (opcode & 0x00F0u) >> 4u;
-		registers[regX] = registers[regX] & registers[regY];
-	}
-	
-	// XOR Vx, Vy - 8xy3 - Performs a bitwise XOR on the values of Vx and Vy, stored in Vx
-	void OP_8xy3() {
-		uint8_t regX = (opcode & 0x0F00u) >> 8u;
-		uint8_t regY = (opcode & 0x00F0u) >> 4u;
-		registers[regX] = registers[regX] ^ registers[regY];
-	}
-
-	// ADD Vx, Vy | 8xy4 | Performs a bitwise AND on the values of Vx and Vy, stored in Vx
-	void OP_8xy4() {
-		uint8_t regX = (opcode & 0x0F00u) >> 8u;
-		uint8_t regY = (opcode & 0x00F0u) >> 4u;
-		uint16_t result = registers[regX] + registers[regY]; // So we can check for carry
-		if (result > 255u) registers[0xF] = 1;	// Set the carry to 1
-		else registers[0xF] = 0;				// No carry, set it to 0
-		registers[regX] = result & 0x00FFu;
-	}
-
-	// SUB Vx, Vy | 8xy5 | Set Vx = Vx - Vy, set VF = NOT borrow
-	void OP_8xy5() {
-		uint8_t regX = (opcode & 0x0F00u) >> 8u;
-		uint8_t regY = (opcode & 0x00F0u) >> 4u;
-		if (registers[regX] > registers[regY]) registers[0xF] = 1;
-		else registers[0xF] = 0;
-		registers[regX] = registers[regX] - registers[regY];
-	}
-
-	// SHR Vx {, Vy} | 8xy6 | Set Vx = Vx SHR 1
-	void OP_8xy6() {
-		uint8_t regX = (opcode & 0x0F00u) >> 8u;
-		registers[0xF] = registers[regX] & 0x1;
-		registers[regX] >>= 1;
-	}
-
-	// SUBN Vx, Vy | 8xy7 | Set Vx = Vy - Vx, set VF = NOT borrow
-	void OP_8xy7() {
-		uint8_t regX = (opcode & 0x0F00u) >> 8u;
-		uint8_t regY = (opcode & 0x00F0u) >> 4u;
-		if (registers[regX] > registers[regY]) registers[0xF] = 1;
-		else registers[0xF] = 0;
-		registers[regX] = registers[regX] - registers[regY];
-	}
-
-	// SHL Vx {, Vy} | 8xyE | Set Vx = Vx 
-	void OP_8xyE() {
-		uint8_t regX = (opcode & 0x0F00u) >> 8u;
-		registers[0xF] = registers[regX] & 0x1;
-		registers[regX] <<= 1;
-	}
-
-	// SNE Vx, Vy | 9xy0 | Skip next instruction if Vx != Vy
-	void OP_9xy0() {
-		uint8_t regX = (opcode & 0x0F00u) >> 8u;
-		uint8_t regY = (opcode & 0x00F0u) >> 4u;
-		if (registers[regX] != registers[regY])
-			pc += 2;
-	}
-
-	// LD I, addr | Annn | The value of register I is set to nnn
-	void OP_Annn() {
-		uint16_t value = opcode & 0x0FFFu;
-		index = value;
-	}
-
-	// JP V0, addr | Bnnn | Jump to location nnn + V0
-	void OP_Bnnn() {
-		uint16_t value = opcode & 0x0FFFu;
-		pc = value + registers[0x0];
-	}
-
-	// RND Vx, byte | Cxkk | Set Vx = random byte AND kk
-	void OP_Cxkk() {
-		uint8_t regX = (opcode & 0x0F00u) >> 8u;
-		uint8_t randVal = genRand();
-		uint8_t value = opcode & 0x00FF;
-		registers[regX] = randVal & value;
-	}
-
-	// DRW Vx, Vy, nibble | Dxyn | Display n-byte sprite starting at memory location I at (Vx, Vy),  set VF = collision
-	void OP_Dxyn() {
-		uint16_t startAddress = index;
-		uint8_t byteCount = opcode & 0x000Fu;
-		uint8_t regX = (opcode & 0x0F00u) >> 8u;
-		uint8_t regY = (opcode & 0x00F0u) >> 4u;
-		uint8_t xCoord = registers[regX];
-		uint8_t yCoord = registers[regY];
-
-		registers[0xF] = 0;
-
-		for (unsigned int row = 0; row < byteCount; ++row)
-		{
-			uint8_t spriteByte = memory[index + row];
-
-			for (unsigned int col = 0; col < 8; ++col)
-			{
-				uint8_t spritePixel = spriteByte & (0x80u >> col);
-				uint32_t* screenPixel = &screen[(yCoord + row) * SCREEN_WIDTH + (xCoord + col)];
-				// Sprite pixel is on
-				if (spritePixel) {
-					// Screen pixel also on - collision
-					if (*screenPixel == 0xFFFFFFFF) {
-						registers[0xF] = 1;
-					}
-					// Effectively XOR with the sprite pixel
-					*screenPixel ^= 0xFFFFFFFF;
-				}
-			}
-		}
-	}
-
-	// SKP Vx | Ex9E | Skip next instruction if key with the value of Vx is pressed
-	void OP_Ex9E() {
-		uint8_t regX = (opcode & 0x0F00u) >> 8u;
-		uint8_t key = registers[regX];
-		if (keypad[key]) pc += 2;
-	}
-	
-	// SKNP Vx | ExA1 | Skip next instruction if key with the value of Vx is not pressed
-	void OP_ExA1() {
-		uint8_t regX = (opcode & 0x0F00u) >> 8u;
-		uint8_t key = registers[regX];
-		if (!keypad[key]) pc += 2;
-	}
-
-	// LD Vx, DT | Fx07 | The value of DT is placed into Vx
-	void OP_Fx07() {
-		uint8_t regX = (opcode & 0x0F00u) >> 8u;
-		registers[regX] = delay_timer;
-	}
-
-	// Potential mistake**LD Vx, K | Fx0A | Wait for a key press, store the value of the key in Vx
-	void OP_Fx0A() {
-		uint8_t regX = (opcode & 0x0F00u) >> 8u;
-		while (true) {
-			for (int i = 0; i < 16; i++) {
-				if (keypad[i]) {
-					registers[regX] = i;
-					return;
-				}
-			}
-		}
-	}
-
-	// LD DT, Vx | Fx15 | Set delay timer = Vx
-	void OP_Fx15() {
-		uint8_t regX = (opcode & 0x0F00u) >> 8u;
-		delay_timer = registers[regX];
-	}
-
-	// LD ST, Vx | Fx18 | Set sound timer = Vx
-	void OP_Fx18() {
-		uint8_t regX = (opcode & 0x0F00u) >> 8u;
-		sound_timer = registers[regX];
-	}
-
-	// ADD I, Vx | Fx1E | The values of I and Vx are added, and the results are stored in I
-	void OP_Fx1E() {
-		uint8_t regX = (opcode & 0x0F00u) >> 8u;
-		index += registers[regX];
-	}
-
-	// LD F, Vx | Fx29 | Set I = location of sprite for digit Vx
-	void OP_Fx29() {
-		uint8_t regX = (opcode & 0x0F00u) >> 8u;
-		uint8_t value = registers[regX];
-		index = FONTSET_START_ADDRESS + (registers[regX] + 5);
-	}
-
-	// LD B, Vx | Fx33 | Store BCD representation of Vx in memory locations I, I+1, and I+2
-	void OP_Fx33() {
-		uint8_t regX = (opcode & 0x0F00u) >> 8u;
-		uint8_t value = registers[regX];
-		uint8_t hundreds = value / 100;
-		uint8_t tens = (value - (hundreds * 100)) / 10;
-		uint8_t ones = (value - (hundreds * 100) - (tens * 10));
-		memory[index] = hundreds;
-		memory[index + 1] = tens;
-		memory[index + 2] = ones;
-	}
-
-	// LD [I], Vx | Fx55 | Store registers V0 through Vx in memory starting at location I
-	void OP_Fx55() {
-		uint8_t regX = (opcode & 0x0F00u) >> 8u;
-		for (uint8_t i = 0; i <= regX; i++) {
-			memory[index + i] = registers[i];
-		}
-	}
-
-	// LD Vx, [I] | Fx65 | Read registers V0 through Vx from memory starting at location I
-	void OP_Fx65() {
-		uint8_t regX = (opcode & 0x0F00u) >> 8u;
-		for (uint8_t i = 0; i <= regX; i++) {
-			registers[i] = memory[index + i];
-		}
-	}
-	
-	void OP_NULL(){}
-	// **************************************
-
-	void (Chip8::*table[16])(){};
-	void (Chip8::* table0[15])() {};
-	void (Chip8::* table8[15])() {};
-	void (Chip8::* tableE[15])() {};
-	void (Chip8::* tableF[102])() {};
-
-	void Table0() {
-		((*this).*(table0[opcode & 0x000Fu]))();
-	}
-
-	void Table8() {
-		((*this).*(table8[opcode & 0x000Fu]))();
-	}
-
-	void TableE() {
-		((*this).*(tableE[opcode & 0x000Fu]))();
-	}
-
-	void TableF() {
-		((*this).*(tableF[opcode & 0x00FFu]))();
-	}
-
-	void Cycle() {
-		// Fetch
-		opcode = (memory[pc] << 8u) + memory[pc + 1];
-		pc += 2;
-
-		// Decode and Execute
-		((*this).*(table[(opcode & 0xF000u) >> 12u]))();
-
-		// Update timers for delay and sound
-		if (delay_timer > 0) --delay_timer;
-		if (sound_timer > 0) --sound_timer;
-	}
-private:
-	void loadFonts() { // Loads the font set in the chip's memory
-		int pos = FONTSET_START_ADDRESS; // Font set start address
-		for (int i = 0; i < FONTSET_SIZE; i++) {
-			memory[pos + i] = fontset[i];
-		}
-	}
-
-	void initTables() {
-		// Start by filling the sub tables with OP_NULL
-		for (int i = 0; i < 102; i++) {
-			if (i < 16) {
-				table0[i] = &Chip8::OP_NULL;
-				table8[i] = &Chip8::OP_NULL;
-				tableE[i] = &Chip8::OP_NULL;
-			}
-			tableF[i] = &Chip8::OP_NULL;
-		}
-
-		// Set up function pointer tables
-		table[0x0] = &Chip8::Table0;
-		table[0x1] = &Chip8::OP_1nnn;
-		table[0x2] = &Chip8::OP_2nnn;
-		table[0x3] = &Chip8::OP_3xkk;
-		table[0x4] = &Chip8::OP_4xkk;
-		table[0x5] = &Chip8::OP_5xy0;
-		table[0x6] = &Chip8::OP_6xkk;
-		table[0x7] = &Chip8::OP_7xkk;
-		table[0x8] = &Chip8::Table8;
-		table[0x9] = &Chip8::OP_9xy0;
-		table[0xA] = &Chip8::OP_Annn;
-		table[0xB] = &Chip8::OP_Bnnn;
-		table[0xC] = &Chip8::OP_Cxkk;
-		table[0xD] = &Chip8::OP_Dxyn;
-		table[0xE] = &Chip8::TableE;
-		table[0xF] = &Chip8::TableF;
-
-		// table0
-		table0[0x0] = &Chip8::OP_00E0;
-		table0[0xE] = &Chip8::OP_00EE;
-
-		// tableE
-		tableE[0x1] = &Chip8::OP_ExA1;
-		tableE[0xE] = &Chip8::OP_Ex9E;
-
-		// table8
-		table8[0x0] = &Chip8::OP_8xy0;
-		table8[0x1] = &Chip8::OP_8xy1;
-		table8[0x2] = &Chip8::OP_8xy2;
-		table8[0x3] = &Chip8::OP_8xy3;
-		table8[0x4] = &Chip8::OP_8xy4;
-		table8[0x5] = &Chip8::OP_8xy5;
-		table8[0x6] = &Chip8::OP_8xy6;
-		table8[0x7] = &Chip8::OP_8xy7;
-		table8[0xE] = &Chip8::OP_8xyE;
-
-		// tableF
-		tableF[0x07] = &Chip8::OP_Fx07;
-		tableF[0x0A] = &Chip8::OP_Fx0A;
-		tableF[0x15] = &Chip8::OP_Fx15;
-		tableF[0x18] = &Chip8::OP_Fx18;
-		tableF[0x1E] = &Chip8::OP_Fx1E;
-		tableF[0x29] = &Chip8::OP_Fx29;
-		tableF[0x33] = &Chip8::OP_Fx33;
-		tableF[0x55] = &Chip8::OP_Fx55;
-		tableF[0x65] = &Chip8::OP_Fx65;
-	}
-};
-
-Chip8::Chip8() { // Constructor of the Chip
-	// Initialize PC 
-	pc = 0x200;
-	// Load the fonts into memory
-	loadFonts();
-	// Setup the tables
-	initTables();
-}
+#include <vector>
+#include <algorithm>
+#include "Chip8.h"
+#include "Display.h"
+#include "FramePacer.h"
+#include "Rewind.h"
+#include "Movie.h"
+#include "Trace.h"
 
 class Platform {
 private:
 	SDL_Window* window{};
 	SDL_Renderer* renderer{};
 	SDL_Texture* texture{};
+	unsigned int textureScale{};
+	std::string title;
 public:
-	Platform(char* windowTitle, int windowWidth, int windowHeight, int textureWidth, int textureHeight) {
+	Palette palette;
+
+	// The texture is textureScale times the size of the screen, expandScreen does the upscaling
+	Platform(char* windowTitle, int windowWidth, int windowHeight, unsigned int textureScale) : textureScale(textureScale), title(windowTitle) {
 		SDL_Init(SDL_INIT_VIDEO);
 		window = SDL_CreateWindow(windowTitle, windowWidth, windowHeight, NULL);
 		renderer = SDL_CreateRenderer(window, NULL);
-		texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, textureWidth, textureHeight);
+		texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH * textureScale, SCREEN_HEIGHT * textureScale);
 		
 		// Set the texture scale to nearest
 		SDL_SetTextureScaleMode(texture, SDL_SCALEMODE_NEAREST);
@@ -494,15 +49,50 @@ public:
 		SDL_Quit();
 	}
 
-	void Update(void const* buffer, int pitch) {
-		SDL_UpdateTexture(texture, nullptr, buffer, pitch);
+	bool exposed = true; // The window needs drawing again even if the screen did not change
+	bool rewinding = false; // Backspace is held, frames run backwards through the rewind buffer
+	bool turbo = false; // Tab toggles it: frames run as fast as the host allows, presented at most once per refresh
+	bool dumpProfile = false; // F2 was pressed, the profiles so far are to be printed
+	std::vector<InputEvent> keyEvents; // Keypad changes since the last call to ProcessInput, in order (frame left at 0)
+
+	// Expands the dirty rows of the packed screen straight into the locked texture, no intermediate
+	// buffer to upload, and presents
+	void Update(const uint64_t* screen, uint32_t dirtyRows) {
+		unsigned int firstRow, lastRow;
+		dirtyRange(dirtyRows, firstRow, lastRow);
+		SDL_Rect area{ 0, (int)(firstRow * textureScale), (int)(SCREEN_WIDTH * textureScale), (int)((lastRow - firstRow) * textureScale) };
+		void* pixels;
+		int pitch;
+		{
+			TraceScope scope("UpdateTexture");
+			if (lastRow > firstRow && SDL_LockTexture(texture, &area, &pixels, &pitch)) {
+				expandScreen(screen, (uint32_t*)pixels, (size_t)pitch / sizeof(uint32_t), textureScale, palette, firstRow, lastRow);
+				SDL_UnlockTexture(texture);
+			}
+		}
+		TraceScope scope("RenderPresent");
 		SDL_RenderClear(renderer);
 		SDL_RenderTexture(renderer, texture, nullptr, nullptr);
 		SDL_RenderPresent(renderer);
+		exposed = false;
 	}
 
-	bool ProcessInput(uint8_t* keys) {
+	// Shows a status after the window title, an empty one goes back to the plain title
+	void SetStatus(const std::string& status) {
+		SDL_SetWindowTitle(window, (status.empty() ? title : title + " - " + status).c_str());
+	}
+
+	// Shortest time between two presents, one refresh of the display the window is on
+	std::chrono::nanoseconds FrameInterval() const {
+		const SDL_DisplayMode* mode = SDL_GetCurrentDisplayMode(SDL_GetDisplayForWindow(window));
+		float refreshRate = mode != nullptr && mode->refresh_rate > 0.0f ? mode->refresh_rate : 60.0f;
+		return std::chrono::nanoseconds((long long)(1e9 / refreshRate));
+	}
+
+	// Polls SDL events, collecting keypad changes in keyEvents for the frame about to run, returns whether to quit
+	bool ProcessInput() {
 		bool quit = false;
+		keyEvents.clear();
 
 		SDL_Event event;
 
@@ -515,6 +105,12 @@ public:
 				quit = true;
 			} break;
 
+			case SDL_EVENT_WINDOW_EXPOSED:
+			case SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED:
+			{
+				exposed = true;
+			} break;
+
 			case SDL_EVENT_KEY_DOWN:
 			{
 				switch (event.key.key)
@@ -524,84 +120,99 @@ public:
 					quit = true;
 				} break;
 
+				case SDLK_BACKSPACE:
+				{
+					rewinding = true;
+				} break;
+
+				case SDLK_TAB:
+				{
+					if (!event.key.repeat) turbo = !turbo;
+				} break;
+
+				case SDLK_F2:
+				{
+					if (!event.key.repeat) dumpProfile = true;
+				} break;
+
 				case SDLK_X:
 				{
-					keys[0] = 1;
+					keyEvent(0, true);
 				} break;
 
 				case SDLK_1:
 				{
-					keys[1] = 1;
+					keyEvent(1, true);
 				} break;
 
 				case SDLK_2:
 				{
-					keys[2] = 1;
+					keyEvent(2, true);
 				} break;
 
 				case SDLK_3:
 				{
-					keys[3] = 1;
+					keyEvent(3, true);
 				} break;
 
 				case SDLK_Q:
 				{
-					keys[4] = 1;
+					keyEvent(4, true);
 				} break;
 
 				case SDLK_W:
 				{
-					keys[5] = 1;
+					keyEvent(5, true);
 				} break;
 
 				case SDLK_E:
 				{
-					keys[6] = 1;
+					keyEvent(6, true);
 				} break;
 
 				case SDLK_A:
 				{
-					keys[7] = 1;
+					keyEvent(7, true);
 				} break;
 
 				case SDLK_S:
 				{
-					keys[8] = 1;
+					keyEvent(8, true);
 				} break;
 
 				case SDLK_D:
 				{
-					keys[9] = 1;
+					keyEvent(9, true);
 				} break;
 
 				case SDLK_Z:
 				{
-					keys[0xA] = 1;
+					keyEvent(0xA, true);
 				} break;
 
 				case SDLK_C:
 				{
-					keys[0xB] = 1;
+					keyEvent(0xB, true);
 				} break;
 
 				case SDLK_4:
 				{
-					keys[0xC] = 1;
+					keyEvent(0xC, true);
 				} break;
 
 				case SDLK_R:
 				{
-					keys[0xD] = 1;
+					keyEvent(0xD, true);
 				} break;
 
 				case SDLK_F:
 				{
-					keys[0xE] = 1;
+					keyEvent(0xE, true);
 				} break;
 
 				case SDLK_V:
 				{
-					keys[0xF] = 1;
+					keyEvent(0xF, true);
 				} break;
 				}
 			} break;
@@ -610,84 +221,89 @@ public:
 			{
 				switch (event.key.key)
 				{
+				case SDLK_BACKSPACE:
+				{
+					rewinding = false;
+				} break;
+
 				case SDLK_X:
 				{
-					keys[0] = 0;
+					keyEvent(0, false);
 				} break;
 
 				case SDLK_1:
 				{
-					keys[1] = 0;
+					keyEvent(1, false);
 				} break;
 
 				case SDLK_2:
 				{
-					keys[2] = 0;
+					keyEvent(2, false);
 				} break;
 
 				case SDLK_3:
 				{
-					keys[3] = 0;
+					keyEvent(3, false);
 				} break;
 
 				case SDLK_Q:
 				{
-					keys[4] = 0;
+					keyEvent(4, false);
 				} break;
 
 				case SDLK_W:
 				{
-					keys[5] = 0;
+					keyEvent(5, false);
 				} break;
 
 				case SDLK_E:
 				{
-					keys[6] = 0;
+					keyEvent(6, false);
 				} break;
 
 				case SDLK_A:
 				{
-					keys[7] = 0;
+					keyEvent(7, false);
 				} break;
 
 				case SDLK_S:
 				{
-					keys[8] = 0;
+					keyEvent(8, false);
 				} break;
 
 				case SDLK_D:
 				{
-					keys[9] = 0;
+					keyEvent(9, false);
 				} break;
 
 				case SDLK_Z:
 				{
-					keys[0xA] = 0;
+					keyEvent(0xA, false);
 				} break;
 
 				case SDLK_C:
 				{
-					keys[0xB] = 0;
+					keyEvent(0xB, false);
 				} break;
 
 				case SDLK_4:
 				{
-					keys[0xC] = 0;
+					keyEvent(0xC, false);
 				} break;
 
 				case SDLK_R:
 				{
-					keys[0xD] = 0;
+					keyEvent(0xD, false);
 				} break;
 
 				case SDLK_F:
 				{
-					keys[0xE] = 0;
+					keyEvent(0xE, false);
 				} break;
 
 				case SDLK_V:
 				{
-					keys[0xF] = 0;
+					keyEvent(0xF, false);
 				} break;
 				}
 			} break;
@@ -696,69 +312,294 @@ public:
 
 		return quit;
 	}
-};
 
-// Function that loads ROM content into memory
-void loadROM(const char* filename, Chip8& chip8) {
-	FILE* file = nullptr;
-	errno_t err = fopen_s(&file, filename, "rb");
-
-	// Check if there are issues with the ROM
-		// Failed to open ROM
-	if (err != 0 || file == nullptr) {
-		std::cerr << "Failed to open ROM file: " << filename << std::endl;
-		exit(-1);
-	}
-	// ROM size too big
-	fseek(file, 0, SEEK_END);
-	int fileSize = ftell(file);
-	fseek(file, 0, SEEK_SET);
-	std::cout << "File size: " << fileSize << std::endl;
-	if (fileSize > (sizeof(chip8.memory) - START_ADDRESS)) {
-		std::cerr << "Size of ROM file is too big: " << filename << std::endl;
-		exit(-1);
+private:
+	void keyEvent(uint8_t key, bool pressed) {
+		keyEvents.push_back(InputEvent{ 0, key, pressed });
 	}
-
-	// Read the ROM content into memory starting at address 0x200
-	uint16_t pos = START_ADDRESS;
-	while (fread(&chip8.memory[pos++], 1, 1, file)) {}
-	fclose(file);
-}
+};
 
 int main(int argc, char* argv[]) {
 	std::cout << "Chip8 Emulator -- Djazy Faradj" << std::endl;
-	
-	if (argc != 4) {
-		std::cerr << "Usage: " << argv[0] << " <Scale> <Delay> <ROM>\n";
+
+	// Options may appear anywhere, everything else is a positional argument
+	std::vector<char*> args;
+	bool hasSeed = false;
+	uint64_t seed = 0;
+	unsigned int instructionsPerFrame = 0; // 0 until --ipf or --cpu-hz
+	bool pacingStats = false;
+	bool profileOpcodes = false;
+	const char* profilePcFilename = nullptr;
+	const char* traceFilename = nullptr;
+	unsigned int rewindSeconds = REWIND_SECONDS;
+	const char* recordFilename = nullptr;
+	const char* replayFilename = nullptr;
+	uint64_t seekFrame = 0;
+	bool turbo = false;
+	unsigned int turboSkip = 0; // 0 until --turbo-skip, presents are then only capped by the host refresh
+	Backend backend = Backend::Table;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--seed" && i + 1 < argc) {
+			hasSeed = true;
+			seed = std::stoull(argv[++i]);
+		}
+		else if (arg == "--backend" && i + 1 < argc) {
+			if (!parseBackend(argv[++i], backend)) {
+				std::cerr << "Unknown backend: " << argv[i] << std::endl;
+				return -1;
+			}
+		}
+		else if (arg == "--pacing-stats") {
+			pacingStats = true;
+		}
+		else if (arg == "--profile-opcodes") {
+			profileOpcodes = true;
+		}
+		else if (arg == "--profile-pc" && i + 1 < argc) {
+			profilePcFilename = argv[++i];
+		}
+		else if (arg == "--trace" && i + 1 < argc) {
+			traceFilename = argv[++i];
+		}
+		else if (arg == "--record" && i + 1 < argc) {
+			recordFilename = argv[++i];
+		}
+		else if (arg == "--replay" && i + 1 < argc) {
+			replayFilename = argv[++i];
+		}
+		else if (arg == "--seek" && i + 1 < argc) {
+			seekFrame = std::stoull(argv[++i]);
+		}
+		else if (arg == "--turbo") {
+			turbo = true;
+		}
+		else if (arg == "--turbo-skip" && i + 1 < argc) {
+			turboSkip = (unsigned int)std::stoul(argv[++i]);
+		}
+		else if (arg == "--rewind" && i + 1 < argc) {
+			rewindSeconds = (unsigned int)std::stoul(argv[++i]);
+		}
+		else if (arg == "--ipf" && i + 1 < argc) {
+			instructionsPerFrame = std::max(1, std::stoi(argv[++i]));
+		}
+		else if (arg == "--cpu-hz" && i + 1 < argc) {
+			instructionsPerFrame = std::max(1u, (unsigned int)std::stoul(argv[++i]) / FRAME_RATE);
+		}
+		else {
+			args.push_back(argv[i]);
+		}
+	}
+
+	if (args.size() < (replayFilename != nullptr ? 1u : 2u) || args.size() > 3) { // A movie brings its program along, the ROM is optional
+		std::cerr << "Usage: " << argv[0] << " [--seed <n>] [--backend table|switch|threaded|predecoded|blocks|jit] [--ipf <n> | --cpu-hz <n>] [--rewind <seconds>] [--record <movie> | --replay <movie> [--seek <frame>]] [--turbo] [--turbo-skip <n>] [--pacing-stats] [--profile-opcodes] [--profile-pc <stacks>] [--trace <json>] <Scale> [Delay] <ROM>\n"
+			<< "       " << argv[0] << " --replay <movie> [--seek <frame>] [options] <Scale> [ROM]\n";
 		int i;
 		std::cout << "Press Q + ENTER to close.";
 		std::cin >> i;
 		return -1;
 	}
 
-	int scale = std::stoi(argv[1]);
-	int cycleDelay = std::stoi(argv[2]);
-	char* romFilename = argv[3];
+	int scale = std::stoi(args[0]);
+	char* romFilename = args.size() > 1 ? args.back() : nullptr; // Only a replay goes without
+	if (instructionsPerFrame == 0) { // The old per-instruction Delay (ms) still sets the speed when given alone
+		int cycleDelay = args.size() == 3 ? std::stoi(args[1]) : 0;
+		instructionsPerFrame = cycleDelay > 0 ? std::max(1u, 1000u / (FRAME_RATE * cycleDelay)) : DEFAULT_INSTRUCTIONS_PER_FRAME;
+	}
+
+	// A replay brings its own seed and speed, a recording needs to know the seed
+	MovieReader* movie = nullptr;
+	if (replayFilename != nullptr) {
+		std::string error;
+		movie = new MovieReader();
+		if (recordFilename != nullptr || !movie->Open(replayFilename, error)) {
+			std::cerr << "Bad movie " << replayFilename << ": " << (recordFilename != nullptr ? "--record given too" : error) << std::endl;
+			return -1;
+		}
+		hasSeed = true;
+		seed = movie->Header().seed;
+		instructionsPerFrame = movie->Header().instructionsPerFrame;
+	}
+	if (recordFilename != nullptr && !hasSeed) {
+		hasSeed = true;
+		seed = ((uint64_t)std::random_device{}() << 32u) | std::random_device{}();
+	}
 
-	Platform* platform = new Platform((char*)"Chip-8 Emulator", SCREEN_WIDTH * scale, SCREEN_HEIGHT * scale, SCREEN_WIDTH, SCREEN_HEIGHT); // Start SDL Platform
+	Platform* platform = new Platform((char*)"Chip-8 Emulator", SCREEN_WIDTH * scale, SCREEN_HEIGHT * scale, scale); // Start SDL Platform
+	platform->turbo = turbo;
 	Chip8* chip8 = new Chip8(); // Instanciate chip
+	if (hasSeed) chip8->Seed(seed);
+	chip8->backend = backend;
 
-	loadROM(romFilename, *chip8); // Load ROM in the chip
-	int videoPitch = sizeof(chip8->screen[0]) * SCREEN_WIDTH;
+	if (romFilename != nullptr) loadROM(romFilename, *chip8); // Load ROM in the chip, a replay without one starts from the movie's first keyframe
+	if (movie != nullptr && romFilename != nullptr && hashProgram(*chip8) != movie->Header().romHash) {
+		std::cerr << "The movie " << replayFilename << " was recorded with another ROM" << std::endl;
+		return -1;
+	}
+	if (movie != nullptr && !movie->Seek(*chip8, seekFrame)) { // From the nearest keyframe, at once
+		std::cerr << "The movie " << replayFilename << " has " << movie->Header().frames << " frames, cannot start at " << seekFrame << std::endl;
+		return -1;
+	}
+
+	// Counted from the first frame played on, F2 prints the profiles so far and quitting the final ones
+	OpcodeProfile* profile = profileOpcodes ? new OpcodeProfile() : nullptr;
+	PcProfile* pcProfile = profilePcFilename != nullptr ? new PcProfile() : nullptr;
+	chip8->opcodeProfile = profile;
+	chip8->pcProfile = pcProfile;
+
+	// Movies are linear, so there is no rewinding while recording
+	MovieWriter* recorder = nullptr;
+	if (recordFilename != nullptr) {
+		recorder = new MovieWriter();
+		if (!recorder->Open(recordFilename, MovieHeader{ instructionsPerFrame, seed, hashProgram(*chip8) })) {
+			std::cerr << "Failed to write " << recordFilename << std::endl;
+			return -1;
+		}
+		rewindSeconds = 0;
+	}
+
+	// Every frame is recorded (cheap XOR deltas) while Backspace is not held, and played back while it is
+	RewindBuffer* rewind = rewindSeconds > 0 ? new RewindBuffer(rewindSeconds * FRAME_RATE, REWIND_BUDGET * rewindSeconds / REWIND_SECONDS) : nullptr;
+	Chip8State rewindState;
 
-	auto lastCycleTime = std::chrono::high_resolution_clock::now();
+	// Fixed 60 Hz frames: instructionsPerFrame instructions, one timer tick, at most one present.
+	// The pacer sleeps between frames instead of spinning on the clock.
+	FramePacer pacer(std::chrono::nanoseconds(1000000000 / FRAME_RATE));
+	auto nextPresent = FramePacer::Clock::now();
+	const auto frameInterval = platform->FrameInterval();
+	uint64_t presentedGeneration = ~chip8->displayGeneration;
 	bool quit = false;
 
+	// A replay runs unthrottled, fed from the movie instead of the keyboard, then play goes on as usual
+	uint64_t frame = seekFrame;
+	bool replaying = movie != nullptr && frame < movie->Header().frames;
+	auto replayStart = FramePacer::Clock::now();
+
+	// Unthrottled (turbo or replaying), input is polled once per host refresh, and the speed shows in the title
+	auto nextPoll = FramePacer::Clock::now();
+	auto speedStart = nextPoll;
+	uint64_t speedFrames = 0;
+	uint64_t framesSincePresent = 0;
+	bool showingSpeed = false;
+
+	// Every phase of a frame is a trace event, the frame itself the one around them
+	if (traceFilename != nullptr) {
+		Trace::NameThread("main");
+		Trace::Start();
+	}
+
 	while (!quit) {
-		quit = platform->ProcessInput(chip8->keypad);
-		auto currentTime = std::chrono::high_resolution_clock::now();
-
-		float dt = std::chrono::duration<float, std::chrono::milliseconds::period>(currentTime - lastCycleTime).count();
-		if (dt > cycleDelay) {
-			lastCycleTime = currentTime;
-			chip8->Cycle();
-			platform->Update(chip8->screen, videoPitch);
+		TraceScope frameScope("Frame");
+		bool unthrottled = replaying || (platform->turbo && !platform->rewinding); // Rewinding stays at 60 Hz
+		if (!unthrottled) {
+			TraceScope scope("WaitForNextFrame");
+			pacer.WaitForNextFrame();
 		}
+		if (!unthrottled || FramePacer::Clock::now() >= nextPoll) {
+			TraceScope scope("ProcessInput");
+			quit = platform->ProcessInput();
+			nextPoll = FramePacer::Clock::now() + frameInterval;
+		}
+		else {
+			platform->keyEvents.clear();
+		}
+		if (replaying) {
+			movie->FeedFrame(*chip8);
+		}
+		else {
+			if (recorder != nullptr) recorder->BeginFrame(*chip8, frame);
+			for (const InputEvent& event : platform->keyEvents) {
+				chip8->KeyEvent(event.key, event.pressed);
+				if (recorder != nullptr) recorder->Record(frame, event.key, event.pressed);
+			}
+		}
+
+		if (rewind != nullptr && platform->rewinding && !replaying) {
+			TraceScope scope("RewindPop");
+			if (rewind->Pop(rewindState)) chip8->LoadState(rewindState);
+		}
+		else {
+			if (rewind != nullptr) {
+				TraceScope scope("RewindPush");
+				rewind->Push(*chip8);
+			}
+			TraceScope scope("RunFrame");
+			chip8->RunFrame(instructionsPerFrame);
+			frame++;
+			speedFrames++;
+			framesSincePresent++;
+		}
+
+		if (platform->dumpProfile) {
+			platform->dumpProfile = false;
+			if (profile != nullptr) printOpcodeProfile(*profile, std::cout);
+			if (pcProfile != nullptr) pcProfile->PrintFlat(std::cout, chip8->memory);
+		}
+
+		if (replaying && frame == movie->Header().frames) {
+			replaying = false;
+			double seconds = std::chrono::duration<double>(FramePacer::Clock::now() - replayStart).count();
+			std::cout << "Replayed " << frame - seekFrame << " frames in " << seconds << " s (" << (frame - seekFrame) / (FRAME_RATE * seconds) << "x real time), ";
+			if (!movie->Complete()) std::cout << "the recording was not closed" << std::endl;
+			else if (hashState(*chip8) == movie->Header().finalStateHash) std::cout << "final state matches the recording" << std::endl;
+			else std::cout << "final state differs from the recording" << std::endl;
+		}
+
+		// Present only when there is something new to show, and never faster than the host display
+		// (nor more often than every turboSkip frames in turbo)
+		auto currentTime = FramePacer::Clock::now();
+		bool changed = chip8->displayGeneration != presentedGeneration;
+		bool skipped = platform->turbo && framesSincePresent < turboSkip;
+		if ((changed || platform->exposed) && currentTime >= nextPresent && !skipped) {
+			platform->Update(chip8->screen, chip8->dirtyRows);
+			chip8->dirtyRows = 0;
+			presentedGeneration = chip8->displayGeneration;
+			nextPresent = currentTime + frameInterval;
+			framesSincePresent = 0;
+		}
+
+		// Effective speed, as a multiple of real time, twice a second while unthrottled
+		double speedSeconds = std::chrono::duration<double>(currentTime - speedStart).count();
+		if (speedSeconds >= 0.5) {
+			if (unthrottled) {
+				char status[64];
+				std::snprintf(status, sizeof(status), "%s %.1fx", replaying ? "replay" : "turbo", speedFrames / (FRAME_RATE * speedSeconds));
+				platform->SetStatus(status);
+				showingSpeed = true;
+			}
+			else if (showingSpeed) {
+				platform->SetStatus("");
+				showingSpeed = false;
+			}
+			speedStart = currentTime;
+			speedFrames = 0;
+		}
+	}
+
+	if (recorder != nullptr) {
+		if (recorder->Close(frame, hashState(*chip8))) std::cout << "Recorded " << frame << " frames to " << recordFilename << std::endl;
+		else std::cerr << "Failed to finish " << recordFilename << std::endl;
+	}
+
+	if (pacingStats) {
+		PacingStats stats = pacer.Stats();
+		std::cout << "Frames: " << stats.frames << ", interval " << stats.meanInterval << " us (jitter " << stats.intervalJitter
+			<< " us), worst lateness " << stats.maxLateness << " us, " << stats.sleepShare * 100 << "% of waiting asleep, "
+			<< stats.resyncs << " resyncs" << std::endl;
+	}
+	if (profile != nullptr) printOpcodeProfile(*profile, std::cout);
+	if (pcProfile != nullptr) {
+		pcProfile->PrintFlat(std::cout, chip8->memory);
+		std::ofstream stacks(profilePcFilename);
+		pcProfile->WriteCollapsed(stacks);
+		if (stacks) std::cout << "Call stacks written to " << profilePcFilename << std::endl;
+		else std::cerr << "Failed to write " << profilePcFilename << std::endl;
+	}
+	if (traceFilename != nullptr) {
+		Trace::Stop();
+		std::ofstream trace(traceFilename);
+		if (Trace::WriteJson(trace)) std::cout << "Trace written to " << traceFilename << std::endl;
+		else std::cerr << "Failed to write " << traceFilename << std::endl;
 	}
 	return 0;
 }